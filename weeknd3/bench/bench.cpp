@@ -0,0 +1,355 @@
+#include "box.h"
+#include "bvh.h"
+#include "color.h"
+#include "fast_math.h"
+#include "pdf.h"
+#include "perlin.h"
+#include "quad.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// microbenchmarks of the intersection and sampling kernels
+// usage: bench [name filter] > results.json
+// every kernel runs over the same inputs, generated from fixed seeds, and
+// reports the fastest of several runs, so that two builds can be compared
+// the dynamic_bvh check animates spheres under a DynamicBVH, the exit code is
+// 1 if it fails
+
+namespace {
+
+const unsigned seed = 1;
+// inputs are cycled through, small enough to stay in cache
+const int input_count = 4096;
+
+struct Benchmark {
+  std::string name;
+  // one call runs the kernel on every input and returns something that
+  // depends on the results, so that the work is not optimized away
+  std::function<double()> run;
+  bool is_ray = false;
+};
+
+struct Result {
+  std::string name;
+  double ns_per_op;
+  bool is_ray;
+};
+
+volatile double sink;
+
+// the fastest of a few runs, each of them long enough for the clock
+double measure(const Benchmark &benchmark) {
+  using clock = std::chrono::steady_clock;
+  const double min_seconds = 0.05;
+  const int runs = 5;
+
+  int batches = 1;
+  while (true) {
+    auto begin = clock::now();
+    for (int k = 0; k < batches; ++k)
+      sink = sink + benchmark.run();
+    auto seconds = std::chrono::duration<double>(clock::now() - begin).count();
+    if (seconds >= min_seconds)
+      break;
+    batches *= 2;
+  }
+
+  double best = infinity;
+  for (int run = 0; run < runs; ++run) {
+    auto begin = clock::now();
+    for (int k = 0; k < batches; ++k)
+      sink = sink + benchmark.run();
+    auto seconds = std::chrono::duration<double>(clock::now() - begin).count();
+    best = std::fmin(best, seconds);
+  }
+  return best * 1e9 / (double(batches) * input_count);
+}
+
+// rays from a sphere of radius 4 around the origin towards points near it
+std::vector<Ray> make_rays(std::mt19937 &rng, double spread) {
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::vector<Ray> rays;
+  for (int k = 0; k < input_count; ++k) {
+    auto origin = glm::normalize(vec3(uniform(rng), uniform(rng),
+                                      uniform(rng))) *
+                  4.;
+    auto target = spread * vec3(uniform(rng), uniform(rng), uniform(rng));
+    rays.emplace_back(origin, target - origin, 0.5 * (uniform(rng) + 1));
+  }
+  return rays;
+}
+
+// count random spheres or quads inside [-1, 1]^3 under a bvh
+shared_ptr<BVHNode> make_sphere_scene(std::mt19937 &rng, int count) {
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  HittableList list;
+  auto radius = 0.5 / std::cbrt(double(count));
+  for (int k = 0; k < count; ++k)
+    list.add(make_shared<Sphere>(
+        vec3(uniform(rng), uniform(rng), uniform(rng)), radius, nullptr));
+  return make_shared<BVHNode>(list);
+}
+
+shared_ptr<BVHNode> make_quad_scene(std::mt19937 &rng, int count) {
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  HittableList list;
+  auto size = 1. / std::cbrt(double(count));
+  for (int k = 0; k < count; ++k) {
+    auto u = size * glm::normalize(vec3(uniform(rng), uniform(rng),
+                                        uniform(rng)));
+    auto v = size * glm::normalize(glm::cross(u, vec3(uniform(rng),
+                                                      uniform(rng),
+                                                      uniform(rng))));
+    list.add(make_shared<Quad>(vec3(uniform(rng), uniform(rng), uniform(rng)),
+                               u, v, nullptr));
+  }
+  return make_shared<BVHNode>(list);
+}
+
+// closest hit including the completed record, as the renderer needs it
+double trace(const Hittable &object, const std::vector<Ray> &rays) {
+  double sum = 0;
+  for (const auto &r : rays) {
+    HitRecord rec;
+    if (object.hit(r, Interval(0.001, infinity), rec)) {
+      rec.finalize(r);
+      sum += rec.t + rec.normal.x;
+    }
+  }
+  return sum;
+}
+
+// moves count spheres by random steps for a number of frames, updating a
+// DynamicBVH, and checks every frame against a bvh built from scratch: the
+// closest hits must be the same and the cost must stay within the rebuild
+// ratio of the last build
+bool check_dynamic_bvh(int count, int frames, std::ostream &output) {
+  using clock = std::chrono::steady_clock;
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  auto radius = 0.5 / std::cbrt(double(count));
+  HittableList list;
+  std::vector<shared_ptr<Sphere>> spheres;
+  std::vector<vec3> centers;
+  for (int k = 0; k < count; ++k) {
+    centers.emplace_back(uniform(rng), uniform(rng), uniform(rng));
+    spheres.push_back(make_shared<Sphere>(centers[k], radius, nullptr));
+    list.add(spheres[k]);
+  }
+  auto rays = make_rays(rng, 1);
+
+  DynamicBVH dynamic(list);
+  double update_seconds = 0, build_seconds = 0;
+  int rebuilds = 0;
+  long long mismatches = 0;
+  bool is_cost_bounded = true;
+  for (int frame = 0; frame < frames; ++frame) {
+    // each sphere moves during the shutter interval, the next frame starts
+    // where it ended
+    for (int k = 0; k < count; ++k) {
+      auto end = centers[k] + radius * vec3(uniform(rng), uniform(rng),
+                                            uniform(rng));
+      spheres[k]->move(centers[k], end);
+      centers[k] = end;
+    }
+
+    auto begin = clock::now();
+    rebuilds += dynamic.update();
+    update_seconds +=
+        std::chrono::duration<double>(clock::now() - begin).count();
+    begin = clock::now();
+    BVHNode fresh(list);
+    build_seconds +=
+        std::chrono::duration<double>(clock::now() - begin).count();
+
+    is_cost_bounded &= dynamic.get_cost() <=
+                       dynamic.get_rebuild_ratio() * dynamic.get_build_cost();
+    for (const auto &r : rays) {
+      HitRecord a, b;
+      bool is_hit_a = dynamic.get_root().hit(r, Interval(0.001, infinity), a);
+      bool is_hit_b = fresh.hit(r, Interval(0.001, infinity), b);
+      mismatches += is_hit_a != is_hit_b ||
+                    (is_hit_a && (a.t != b.t || a.object != b.object));
+    }
+  }
+
+  std::clog << "dynamic_bvh " << rebuilds << " rebuilds in " << frames
+            << " frames, " << mismatches << " mismatches" << std::endl;
+  output << "{\"spheres\": " << count << ", \"frames\": " << frames
+         << ", \"update_ms\": " << 1e3 * update_seconds / frames
+         << ", \"build_ms\": " << 1e3 * build_seconds / frames
+         << ", \"rebuilds\": " << rebuilds
+         << ", \"hit_mismatches\": " << mismatches
+         << ", \"cost_bounded\": " << (is_cost_bounded ? "true" : "false")
+         << "}";
+  return mismatches == 0 && is_cost_bounded;
+}
+
+std::vector<Benchmark> make_benchmarks() {
+  std::mt19937 rng(seed);
+  seed_random(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<Benchmark> benchmarks;
+
+  // random_double() draws from the stream of the thread, reseeded so every
+  // run sees the same sequence
+  benchmarks.push_back({"random_double", [] {
+                          seed_random(seed);
+                          double sum = 0;
+                          for (int k = 0; k < input_count; ++k)
+                            sum += random_double();
+                          return sum;
+                        }});
+
+  auto rays = make_shared<std::vector<Ray>>(make_rays(rng, 1));
+  auto box = make_shared<AABB>(vec3(-1, -1, -1), vec3(1, 1, 1));
+  benchmarks.push_back({"aabb_hit",
+                        [=] {
+                          double sum = 0;
+                          for (const auto &r : *rays)
+                            sum += box->hit(r, Interval(0.001, infinity));
+                          return sum;
+                        },
+                        true});
+
+  auto sphere = make_shared<Sphere>(vec3(0, 0, 0), 1, nullptr);
+  benchmarks.push_back(
+      {"sphere_hit", [=] { return trace(*sphere, *rays); }, true});
+  auto quad = make_shared<Quad>(vec3(-1, -1, 0), vec3(2, 0, 0),
+                                vec3(0, 2, 0), nullptr);
+  benchmarks.push_back({"quad_hit", [=] { return trace(*quad, *rays); }, true});
+  auto solid_box = make_shared<Box>(vec3(-1, -1, -1), vec3(1, 1, 1), nullptr);
+  benchmarks.push_back(
+      {"box_hit", [=] { return trace(*solid_box, *rays); }, true});
+
+  auto set = make_shared<SphereSet>();
+  for (int k = 0; k < SphereSet::size; ++k) {
+    auto center = vec3(uniform(rng), uniform(rng), uniform(rng)) * 2. - 1.;
+    set->add(SphereDesc{center, center, 0.3, nullptr});
+  }
+  benchmarks.push_back(
+      {"sphere_set_hit", [=] { return trace(*set, *rays); }, true});
+
+  for (int count : {1000, 100000}) {
+    auto scene = make_sphere_scene(rng, count);
+    benchmarks.push_back({"bvh_spheres_" + std::to_string(count),
+                          [=] { return trace(*scene, *rays); }, true});
+  }
+  auto quads = make_quad_scene(rng, 10000);
+  benchmarks.push_back(
+      {"bvh_quads_10000", [=] { return trace(*quads, *rays); }, true});
+
+  auto perlin = make_shared<Perlin>();
+  auto points = make_shared<std::vector<vec3>>();
+  for (int k = 0; k < input_count; ++k)
+    points->push_back(16. * vec3(uniform(rng), uniform(rng), uniform(rng)));
+  benchmarks.push_back({"perlin_noise", [=] {
+                          double sum = 0;
+                          for (const auto &p : *points)
+                            sum += perlin->noise(p);
+                          return sum;
+                        }});
+  benchmarks.push_back({"perlin_turb", [=] {
+                          double sum = 0;
+                          for (const auto &p : *points)
+                            sum += perlin->turb(p, 7);
+                          return sum;
+                        }});
+
+  auto pdf = make_shared<CosinePDF>(vec3(0.3, 0.9, 0.1));
+  benchmarks.push_back({"cosine_pdf_generate", [=] {
+                          seed_random(seed);
+                          double sum = 0;
+                          for (int k = 0; k < input_count; ++k)
+                            sum += pdf->generate().x;
+                          return sum;
+                        }});
+
+  auto colors = make_shared<std::vector<color>>();
+  for (int k = 0; k < input_count; ++k)
+    colors->push_back(1.2 * color(uniform(rng), uniform(rng), uniform(rng)));
+  benchmarks.push_back({"write_color", [=] {
+                          std::ostringstream output;
+                          for (const auto &c : *colors)
+                            write_color(output, c);
+                          return double(output.tellp());
+                        }});
+
+  // libm against the approximations behind FAST_MATH, whichever is built
+  auto units = make_shared<std::vector<double>>();
+  for (int k = 0; k < input_count; ++k)
+    units->push_back(uniform(rng));
+  auto math = [&](const std::string &name, double (*f)(double)) {
+    benchmarks.push_back({name, [=] {
+                            double sum = 0;
+                            for (double x : *units)
+                              sum += f(x);
+                            return sum;
+                          }});
+  };
+  math("pow_libm", [](double x) { return std::pow(x, 1 / 2.2); });
+  math("pow_approx", [](double x) { return approx::pow(x, 1 / 2.2); });
+  math("sincos_libm",
+       [](double x) { return std::sin(6.28 * x) + std::cos(6.28 * x); });
+  math("sincos_approx", [](double x) {
+    double s, c;
+    approx::sincos(6.28 * x, s, c);
+    return s + c;
+  });
+  math("atan2_libm", [](double x) { return std::atan2(x - 0.5, 0.5 - x * x); });
+  math("atan2_approx",
+       [](double x) { return approx::atan2(x - 0.5, 0.5 - x * x); });
+  math("acos_libm", [](double x) { return std::acos(2 * x - 1); });
+  math("acos_approx", [](double x) { return approx::acos(2 * x - 1); });
+
+  return benchmarks;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *filter = argc > 1 ? argv[1] : "";
+  auto benchmarks = make_benchmarks();
+
+  std::vector<Result> results;
+  for (const auto &benchmark : benchmarks) {
+    if (benchmark.name.find(filter) == std::string::npos)
+      continue;
+    std::clog << benchmark.name << std::flush;
+    auto ns = measure(benchmark);
+    std::clog << " " << ns << " ns" << std::endl;
+    results.push_back({benchmark.name, ns, benchmark.is_ray});
+  }
+
+#ifdef FAST_MATH
+  const bool fast_math = true;
+#else
+  const bool fast_math = false;
+#endif
+  std::cout << "{\n  \"seed\": " << seed << ",\n  \"fast_math\": "
+            << (fast_math ? "true" : "false") << ",\n  \"benchmarks\": [";
+  for (size_t k = 0; k < results.size(); ++k) {
+    const auto &result = results[k];
+    std::cout << (k ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+              << "\", \"ns_per_op\": " << result.ns_per_op;
+    if (result.is_ray)
+      std::cout << ", \"rays_per_sec\": " << 1e9 / result.ns_per_op;
+    std::cout << "}";
+  }
+  std::cout << "\n  ]";
+
+  bool is_ok = true;
+  if (std::string("dynamic_bvh").find(filter) != std::string::npos) {
+    std::cout << ",\n  \"dynamic_bvh\": ";
+    is_ok = check_dynamic_bvh(100000, 16, std::cout);
+  }
+  std::cout << "\n}" << std::endl;
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+#include "scene.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+// end-to-end benchmark: renders whole scenes without writing the image and
+// reports time, rays, Mrays/s, peak memory and the error against a reference
+//
+// usage: render_bench [options] [scene files] > results.json
+//   --width <w> --height <h>   image size, the scene's by default, one of
+//                              them keeps the scene's aspect ratio
+//   --spp <n>                  samples per pixel, the scene's by default
+//   --threads <n>              0 for one thread per hardware thread
+//   --references <dir>         <dir>/<scene>.pfm is the reference image
+//   --write-references         render the references instead, at the
+//                              --spp given (1024 by default)
+//   --trace <file.json>        timeline of the whole run for perfetto
+//   --check-integrators        render with the recursive, packet and
+//                              wavefront integrators instead and fail
+//                              unless the images are bit-identical
+// without scene files the scenes of SCENE_DIR are rendered
+//
+// the error is the rmse of the colors clamped to [0, 1], efficiency is
+// 1 / (rmse^2 * seconds), so a faster render with the same noise and a less
+// noisy one in the same time both score higher
+
+namespace {
+
+struct Options {
+  int width = 0, height = 0, spp = 0, threads = 1;
+  std::string references, trace;
+  bool write_references = false, check_integrators = false;
+  std::vector<std::string> scenes;
+};
+
+bool parse_options(int argc, char **argv, Options &options) {
+  for (int k = 1; k < argc; ++k) {
+    std::string arg = argv[k];
+    auto value = [&](int &result) {
+      if (k + 1 >= argc)
+        return false;
+      result = std::atoi(argv[++k]);
+      return true;
+    };
+    bool is_valid = true;
+    if (arg == "--width")
+      is_valid = value(options.width);
+    else if (arg == "--height")
+      is_valid = value(options.height);
+    else if (arg == "--spp")
+      is_valid = value(options.spp);
+    else if (arg == "--threads")
+      is_valid = value(options.threads);
+    else if (arg == "--references" && k + 1 < argc)
+      options.references = argv[++k];
+    else if (arg == "--trace" && k + 1 < argc)
+      options.trace = argv[++k];
+    else if (arg == "--write-references")
+      options.write_references = true;
+    else if (arg == "--check-integrators")
+      options.check_integrators = true;
+    else if (arg.rfind("--", 0) == 0)
+      is_valid = false;
+    else
+      options.scenes.push_back(arg);
+    if (!is_valid) {
+      std::cerr << "ERROR: invalid option '" << arg << "'.\n";
+      return false;
+    }
+  }
+  if (options.write_references && options.references.empty()) {
+    std::cerr << "ERROR: --write-references needs --references.\n";
+    return false;
+  }
+  if (options.scenes.empty()) {
+    for (const char *name :
+         {"bouncing_spheres", "checkered_spheres", "perlin_spheres", "quads",
+          "cornell_box", "cornell_smoke"})
+      options.scenes.push_back(std::string(SCENE_DIR) + "/" + name + ".scene");
+  }
+  return true;
+}
+
+// file name without directory and extension
+std::string scene_name(const std::string &filename) {
+  auto begin = filename.find_last_of('/');
+  begin = begin == std::string::npos ? 0 : begin + 1;
+  auto end = filename.find_last_of('.');
+  if (end == std::string::npos || end < begin)
+    end = filename.size();
+  return filename.substr(begin, end - begin);
+}
+
+// the peak is reset so that every scene reports its own, which the kernel
+// allows through clear_refs, otherwise it is the peak of the whole process
+void reset_peak_rss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+}
+
+double peak_rss_mb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0)
+      return std::atof(line.c_str() + 6) / 1024;
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.;
+}
+
+double rmse(const Image<color> &image, const Image<vec3> &reference) {
+  double sum = 0;
+  for (int j = 0; j < image.get_height(); ++j) {
+    for (int i = 0; i < image.get_width(); ++i) {
+      auto difference = glm::clamp(image.at(i, j), 0., 1.) -
+                        glm::clamp(reference.at(i, j), 0., 1.);
+      sum += glm::dot(difference, difference);
+    }
+  }
+  return std::sqrt(sum / (3. * image.get_width() * image.get_height()));
+}
+
+// the image as written by Camera::render
+std::string to_ppm(const Image<color> &image) {
+  std::ostringstream output;
+  for (int j = 0; j < image.get_height(); ++j)
+    for (int i = 0; i < image.get_width(); ++i)
+      write_color(output, image.at(i, j));
+  return output.str();
+}
+
+// every integrator keys the random numbers by the pixel, sample and depth
+// (media included), so they must write the same image. the wavefront sums
+// the path forward instead of recursively, which only changes the last bits
+// of the colors, so the written bytes are compared
+bool check_integrators(Camera &camera, const Hittable &world,
+                       std::ostream &output) {
+  FrameBuffer recursive(camera.get_image_width(), camera.get_image_height());
+  FrameBuffer packets(camera.get_image_width(), camera.get_image_height());
+  FrameBuffer wavefront(camera.get_image_width(), camera.get_image_height());
+  camera.set_integrator(IntegratorType::Recursive);
+  camera.set_packet_tracing(false);
+  camera.render(world, recursive);
+  camera.set_packet_tracing(true);
+  camera.render(world, packets);
+  camera.set_integrator(IntegratorType::Wavefront);
+  camera.render(world, wavefront);
+  std::clog << std::endl;
+
+  auto image = to_ppm(recursive.beauty);
+  bool is_packets_identical = to_ppm(packets.beauty) == image;
+  bool is_wavefront_identical = to_ppm(wavefront.beauty) == image;
+  output << ", \"packets_identical\": "
+         << (is_packets_identical ? "true" : "false")
+         << ", \"wavefront_identical\": "
+         << (is_wavefront_identical ? "true" : "false") << "}";
+  if (!is_packets_identical || !is_wavefront_identical)
+    std::cerr << "ERROR: the integrators differ.\n";
+  return is_packets_identical && is_wavefront_identical;
+}
+
+// one json object, false if the scene could not be rendered
+bool run(const Options &options, const std::string &filename,
+         std::ostream &output) {
+  using clock = std::chrono::steady_clock;
+  reset_peak_rss();
+  auto load_begin = clock::now();
+  auto scene = load_scene(filename);
+  if (!scene)
+    return false;
+  auto load_seconds =
+      std::chrono::duration<double>(clock::now() - load_begin).count();
+
+  auto &camera = *scene->camera;
+  int width = options.width, height = options.height;
+  if (width > 0 || height > 0) {
+    if (width <= 0)
+      width = height * camera.get_image_width() / camera.get_image_height();
+    if (height <= 0)
+      height = width * camera.get_image_height() / camera.get_image_width();
+    camera.set_image_size(width, height);
+  }
+  int spp = options.spp;
+  if (spp <= 0 && options.write_references)
+    spp = 1024;
+  if (spp > 0)
+    camera.set_samples_per_pixel(spp);
+  camera.set_threads(options.threads);
+
+  auto name = scene_name(filename);
+  auto reference_file = options.references + "/" + name + ".pfm";
+  Image<vec3> reference;
+  bool has_reference = !options.references.empty() &&
+                       !options.write_references &&
+                       read_pfm(reference_file, reference);
+  if (has_reference &&
+      (reference.get_width() != camera.get_image_width() ||
+       reference.get_height() != camera.get_image_height())) {
+    std::cerr << "ERROR: reference '" << reference_file
+              << "' has a different size.\n";
+    has_reference = false;
+  }
+
+  std::clog << name << std::endl;
+  if (options.check_integrators) {
+    output << "    {\"scene\": \"" << name
+           << "\", \"width\": " << camera.get_image_width()
+           << ", \"height\": " << camera.get_image_height()
+           << ", \"spp\": " << camera.get_samples_per_pixel();
+    return check_integrators(camera, scene->world, output);
+  }
+
+  FrameBuffer fb(camera.get_image_width(), camera.get_image_height());
+  auto render_begin = clock::now();
+  camera.render(scene->world, fb);
+  auto seconds =
+      std::chrono::duration<double>(clock::now() - render_begin).count();
+  std::clog << std::endl;
+
+  if (options.write_references && !write_pfm(reference_file, fb.beauty)) {
+    std::cerr << "ERROR: could not write '" << reference_file << "'.\n";
+    return false;
+  }
+
+  auto rays = camera.get_rays_traced();
+  output << "    {\"scene\": \"" << name
+         << "\", \"width\": " << camera.get_image_width()
+         << ", \"height\": " << camera.get_image_height()
+         << ", \"spp\": " << camera.get_samples_per_pixel()
+         << ", \"threads\": " << get_thread_count(options.threads)
+         << ", \"load_seconds\": " << load_seconds
+         << ", \"seconds\": " << seconds << ", \"rays\": " << rays
+         << ", \"mrays_per_sec\": " << rays / seconds * 1e-6
+         << ", \"peak_rss_mb\": " << peak_rss_mb();
+  if (has_reference) {
+    auto error = rmse(fb.beauty, reference);
+    output << ", \"rmse\": " << error
+           << ", \"efficiency\": " << 1 / (error * error * seconds);
+  }
+  output << "}";
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options))
+    return 1;
+  if (!options.trace.empty())
+    Tracer::get().start();
+
+  std::cout << "{\n  \"scenes\": [";
+  bool ok = true, is_first = true;
+  for (const auto &filename : options.scenes) {
+    std::ostringstream result;
+    ok &= run(options, filename, result);
+    // failed checks are reported too
+    if (result.str().empty())
+      continue;
+    std::cout << (is_first ? "\n" : ",\n") << result.str() << std::flush;
+    is_first = false;
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+
+  if (!options.trace.empty() && !Tracer::get().write(options.trace)) {
+    std::cerr << "ERROR: could not write '" << options.trace << "'.\n";
+    return 1;
+  }
+  return ok ? 0 : 1;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "interval.h"
+#include "packet.h"
 #include "ray.h"
+#include "stats.h"
 
 class AABB {
   void pad2minimums() {
@@ -33,6 +35,9 @@ public:
     x = (a[0] <= b[0]) ? Interval(a[0], b[0]) : Interval(b[0], a[0]);
     y = (a[1] <= b[1]) ? Interval(a[1], b[1]) : Interval(b[1], a[1]);
     z = (a[2] <= b[2]) ? Interval(a[2], b[2]) : Interval(b[2], a[2]);
+    // flat boxes (e.g. of an axis-aligned quad) would be missed by the slab
+    // test
+    pad2minimums();
   }
 
   AABB(const AABB &box0, const AABB &box1) {
@@ -46,6 +51,7 @@ public:
   }
 
   bool hit(const Ray &r, Interval ray_t) const {
+    RENDER_STAT(aabb_tests);
     const vec3 &ray_orig = r.origin();
     // no need to normalize here
     const vec3 &ray_dir = r.direction();
@@ -76,6 +82,89 @@ public:
     return true;
   }
 
+  // slab test of every lane against [t_min, t_max[lane]]
+  // writes the lanes that enter the box into mask and returns if any does
+  // bounds are copied to locals and plain comparisons are used instead of
+  // std::fmin/fmax, otherwise the loop is not vectorized
+  // the comparisons are those of hit(), so that a NaN slab value (a ray
+  // parallel to a face, starting on its plane) decides the same in both
+  bool hit_packet(const RayPacket &packet, double t_min, const double *t_max,
+                  bool *mask) const {
+    RENDER_STAT_ADD(aabb_tests, packet.active_count());
+    const double x0 = x.min, x1 = x.max;
+    const double y0 = y.min, y1 = y.max;
+    const double z0 = z.min, z1 = z.max;
+    double t_enter[RayPacket::size], t_exit[RayPacket::size];
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      double enter = t_min, exit = t_max[lane];
+      auto slab = [&](double t0, double t1) {
+        auto near = t0 < t1 ? t0 : t1;
+        auto far = t0 < t1 ? t1 : t0;
+        enter = near > enter ? near : enter;
+        exit = far < exit ? far : exit;
+      };
+      slab((x0 - packet.ox[lane]) * packet.inv_dx[lane],
+           (x1 - packet.ox[lane]) * packet.inv_dx[lane]);
+      slab((y0 - packet.oy[lane]) * packet.inv_dy[lane],
+           (y1 - packet.oy[lane]) * packet.inv_dy[lane]);
+      slab((z0 - packet.oz[lane]) * packet.inv_dz[lane],
+           (z1 - packet.oz[lane]) * packet.inv_dz[lane]);
+      t_enter[lane] = enter;
+      t_exit[lane] = exit;
+    }
+
+    bool any = false;
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      mask[lane] = packet.active[lane] && t_enter[lane] < t_exit[lane];
+      any |= mask[lane];
+    }
+    return any;
+  }
+
+  bool operator==(const AABB &other) const {
+    return x.min == other.x.min && x.max == other.x.max &&
+           y.min == other.y.min && y.max == other.y.max &&
+           z.min == other.z.min && z.max == other.z.max;
+  }
+
+  // slab test against the linear interpolation of the boxes at the time of
+  // the ray, begin at time 0 and end at 1
+  static bool hit_moving(const AABB &begin, const AABB &end, const Ray &r,
+                         Interval ray_t) {
+    RENDER_STAT(aabb_tests);
+    const auto t = r.time();
+    for (int axis = 0; axis < 3; axis++) {
+      const Interval &ax0 = begin.axis_interval(axis);
+      const Interval &ax1 = end.axis_interval(axis);
+      const double adinv = 1.0 / r.direction()[axis];
+      const double origin = r.origin()[axis];
+
+      auto t0 = (ax0.min + t * (ax1.min - ax0.min) - origin) * adinv;
+      auto t1 = (ax0.max + t * (ax1.max - ax0.max) - origin) * adinv;
+      if (t0 > t1)
+        std::swap(t0, t1);
+      if (t0 > ray_t.min)
+        ray_t.min = t0;
+      if (t1 < ray_t.max)
+        ray_t.max = t1;
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  // nothing has been added to an empty box
+  bool is_empty() const {
+    return x.min > x.max || y.min > y.max || z.min > z.max;
+  }
+
+  double surface_area() const {
+    if (is_empty())
+      return 0;
+    auto dx = x.size(), dy = y.size(), dz = z.size();
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
   int longest_axis() const {
     // Returns the index of the longest axis of the bounding box.
 
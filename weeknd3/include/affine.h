@@ -0,0 +1,148 @@
+#pragma once
+#include "aabb.h"
+#include "common.h"
+
+// affine transform stored as a 3x4 row-major matrix [linear | translation]
+// (a * b) applies b first, like matrices acting on column vectors
+class Affine {
+public:
+  double m[3][4];
+
+  // identity
+  Affine() {
+    for (int row = 0; row < 3; ++row)
+      for (int col = 0; col < 4; ++col)
+        m[row][col] = row == col ? 1 : 0;
+  }
+
+  static Affine translate(const vec3 &offset) {
+    Affine a;
+    a.m[0][3] = offset.x;
+    a.m[1][3] = offset.y;
+    a.m[2][3] = offset.z;
+    return a;
+  }
+
+  static Affine scale(const vec3 &factor) {
+    Affine a;
+    a.m[0][0] = factor.x;
+    a.m[1][1] = factor.y;
+    a.m[2][2] = factor.z;
+    return a;
+  }
+
+  // counter-clockwise about the axis (0 for x, 1 for y, 2 for z) when looking
+  // from its positive side
+  static Affine rotate(int axis, double degrees) {
+    auto radians = degrees2radians(degrees);
+    auto s = std::sin(radians), c = std::cos(radians);
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    Affine a;
+    a.m[u][u] = c;
+    a.m[u][v] = -s;
+    a.m[v][u] = s;
+    a.m[v][v] = c;
+    return a;
+  }
+
+  Affine operator*(const Affine &b) const {
+    Affine a;
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 4; ++col) {
+        a.m[row][col] = col == 3 ? m[row][3] : 0;
+        for (int k = 0; k < 3; ++k)
+          a.m[row][col] += m[row][k] * b.m[k][col];
+      }
+    }
+    return a;
+  }
+
+  vec3 transform_point(const vec3 &p) const {
+    return vec3(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+  }
+
+  vec3 transform_vector(const vec3 &d) const {
+    return vec3(m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z,
+                m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z,
+                m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z);
+  }
+
+  // multiplies by the transposed linear part: called on the inverse
+  // transform, this maps normals from object to world space
+  vec3 transform_normal_transposed(const vec3 &n) const {
+    return vec3(m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+  }
+
+  // the transposed linear part without translation: of the inverse
+  // transform, this is the normal matrix
+  Affine transposed_linear() const {
+    Affine a;
+    for (int row = 0; row < 3; ++row)
+      for (int col = 0; col < 3; ++col)
+        a.m[row][col] = m[col][row];
+    return a;
+  }
+
+  // rotation, reflection and uniform scale only: angles are kept, so are the
+  // solid angle densities of light sampling
+  bool is_similarity() const {
+    vec3 columns[3];
+    for (int col = 0; col < 3; ++col)
+      columns[col] = vec3(m[0][col], m[1][col], m[2][col]);
+    auto scale = glm::dot(columns[0], columns[0]);
+    const double tolerance = 1e-9 * scale;
+    for (int col = 0; col < 3; ++col) {
+      if (std::fabs(glm::dot(columns[col], columns[col]) - scale) > tolerance ||
+          std::fabs(glm::dot(columns[col], columns[(col + 1) % 3])) > tolerance)
+        return false;
+    }
+    return scale > 0;
+  }
+
+  double determinant() const {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  // the transform must not be singular
+  Affine inverse() const {
+    Affine a;
+    auto inv_det = 1. / determinant();
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 3; ++col) {
+        // cofactor of (col, row)
+        int r0 = (col + 1) % 3, r1 = (col + 2) % 3;
+        int c0 = (row + 1) % 3, c1 = (row + 2) % 3;
+        a.m[row][col] =
+            (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) * inv_det;
+      }
+    }
+    auto t = a.transform_vector(vec3(m[0][3], m[1][3], m[2][3]));
+    a.m[0][3] = -t.x;
+    a.m[1][3] = -t.y;
+    a.m[2][3] = -t.z;
+    return a;
+  }
+
+  // bounds of the transformed box, from its center and half extent
+  AABB transform_box(const AABB &box) const {
+    if (box.is_empty())
+      return box;
+    vec3 center(box.x.min + box.x.max, box.y.min + box.y.max,
+                box.z.min + box.z.max);
+    vec3 half(box.x.size(), box.y.size(), box.z.size());
+    center = transform_point(center * 0.5);
+    half *= 0.5;
+    vec3 extent;
+    for (int row = 0; row < 3; ++row)
+      extent[row] = std::fabs(m[row][0]) * half.x +
+                    std::fabs(m[row][1]) * half.y +
+                    std::fabs(m[row][2]) * half.z;
+    return AABB(center - extent, center + extent);
+  }
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include "hittable.h"
+
+// axis-aligned box, one slab test instead of six quads
+// faces, normals and uv match the six quads the box used to be made of
+class Box : public Hittable {
+public:
+  // a & b are opposite corners, the box must not be flat on any axis
+  Box(const vec3 &a, const vec3 &b, shared_ptr<Material> _mat)
+      : box_min(glm::min(a, b)), box_max(glm::max(a, b)), mat(_mat) {
+    bbox = AABB(box_min, box_max);
+    auto size = box_max - box_min;
+    for (int axis = 0; axis < 3; ++axis) {
+      // faces perpendicular to the axis
+      face_area[axis] = size[(axis + 1) % 3] * size[(axis + 2) % 3];
+    }
+    area = 2 * (face_area[0] + face_area[1] + face_area[2]);
+  }
+
+  void debugp() const override { std::clog << "box" << std::flush; }
+
+  AABB get_bbox() const override { return bbox; }
+
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    RENDER_STAT(box_tests);
+    double t_enter, t_exit;
+    int enter_axis, exit_axis;
+    if (!slab(r, t_enter, t_exit, enter_axis, exit_axis))
+      return false;
+
+    // from inside the box (or behind the entry point) the exit face is hit
+    double t;
+    int axis;
+    if (ray_t.contains(t_enter)) {
+      t = t_enter;
+      axis = enter_axis;
+    } else if (ray_t.contains(t_exit)) {
+      t = t_exit;
+      axis = exit_axis;
+    } else {
+      return false;
+    }
+
+    rec.t = t;
+    rec.object = this;
+    rec.primitive = uint32_t(axis);
+    return true;
+  }
+
+  void finalize(const Ray &r, HitRecord &rec) const override {
+    const int axis = int(rec.primitive);
+    auto p = r.at(rec.t);
+    // the face the point lies on, by the nearer side of the slab
+    bool is_max = std::fabs(p[axis] - box_max[axis]) <
+                  std::fabs(p[axis] - box_min[axis]);
+    vec3 outward(0, 0, 0);
+    outward[axis] = is_max ? 1 : -1;
+
+    rec.set(p, rec.t, mat);
+    rec.set_face_normal(r, outward);
+    rec.object_id = id;
+    get_face_uv(p, axis, is_max, rec.u, rec.v);
+  }
+
+  // a ray can cross the surface twice, both points contribute to the density
+  // of uniformly sampled points
+  double pdf_value(const vec3 &origin, const vec3 &direction) const override {
+    Ray r(origin, direction);
+    double t_enter, t_exit;
+    int enter_axis, exit_axis;
+    if (!slab(r, t_enter, t_exit, enter_axis, exit_axis))
+      return 0;
+
+    auto length_squared = glm::dot(direction, direction);
+    auto pdf = 0.0;
+    const double ts[2] = {t_enter, t_exit};
+    const int axes[2] = {enter_axis, exit_axis};
+    for (int k = 0; k < 2; ++k) {
+      if (ts[k] <= 0.001)
+        continue;
+      auto distance_squared = ts[k] * ts[k] * length_squared;
+      auto cosine = std::fabs(direction[axes[k]]) / std::sqrt(length_squared);
+      pdf += distance_squared / (cosine * area);
+    }
+    return pdf;
+  }
+
+  vec3 random(const vec3 &origin) const override {
+    return random(origin, vec2(random_double(), random_double()));
+  }
+
+  // a face picked by area with the first component, a point on it with what
+  // is left of it and the second component
+  vec3 random(const vec3 &origin, const vec2 &sample) const override {
+    auto pick = sample.x * area;
+    int face = 0;
+    while (face < 5 && pick >= face_area[face / 2]) {
+      pick -= face_area[face / 2];
+      ++face;
+    }
+    int axis = face / 2;
+    int u_axis = (axis + 1) % 3, v_axis = (axis + 2) % 3;
+    auto size = box_max - box_min;
+    vec3 p;
+    p[axis] = face % 2 ? box_max[axis] : box_min[axis];
+    p[u_axis] = box_min[u_axis] +
+                std::fmin(pick / face_area[axis], 1.) * size[u_axis];
+    p[v_axis] = box_min[v_axis] + sample.y * size[v_axis];
+    return p - origin;
+  }
+
+private:
+  vec3 box_min, box_max;
+  shared_ptr<Material> mat;
+  AABB bbox;
+  double face_area[3];
+  double area;
+
+  // entry and exit of the ray's line through the box, and the axes of the
+  // faces where they happen
+  bool slab(const Ray &r, double &t_enter, double &t_exit, int &enter_axis,
+            int &exit_axis) const {
+    t_enter = -infinity;
+    t_exit = infinity;
+    enter_axis = exit_axis = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double adinv = 1.0 / r.direction()[axis];
+      auto t0 = (box_min[axis] - r.origin()[axis]) * adinv;
+      auto t1 = (box_max[axis] - r.origin()[axis]) * adinv;
+      if (t0 > t1)
+        std::swap(t0, t1);
+      if (t0 > t_enter) {
+        t_enter = t0;
+        enter_axis = axis;
+      }
+      if (t1 < t_exit) {
+        t_exit = t1;
+        exit_axis = axis;
+      }
+    }
+    return t_enter <= t_exit;
+  }
+
+  // the plane coordinates the quads of each face had
+  void get_face_uv(const vec3 &p, int axis, bool is_max, double &u,
+                   double &v) const {
+    auto rel = (p - box_min) / (box_max - box_min);
+    if (axis == 0) {
+      // right (x max) and left
+      u = is_max ? 1 - rel.z : rel.z;
+      v = rel.y;
+    } else if (axis == 1) {
+      // top (y max) and bottom
+      u = rel.x;
+      v = is_max ? 1 - rel.z : rel.z;
+    } else {
+      // front (z max) and back
+      u = is_max ? rel.x : 1 - rel.x;
+      v = rel.y;
+    }
+  }
+};
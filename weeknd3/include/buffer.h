@@ -0,0 +1,90 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+// array that either owns its elements or views memory owned by someone else
+// (e.g. a memory mapped cache file kept alive through owner)
+// the owned form has the small part of the std::vector interface the
+// loaders need, a view is read only
+template <typename T> class Buffer {
+public:
+  Buffer() {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  bool is_view() const { return owner != nullptr; }
+
+  const T *data() const { return items; }
+  const T *begin() const { return items; }
+  const T *end() const { return items + count; }
+  const T &operator[](size_t k) const { return items[k]; }
+  const T &back() const { return items[count - 1]; }
+
+  // writing through it is only allowed on owned buffers, views are mapped
+  // read only
+  T &operator[](size_t k) { return const_cast<T &>(items[k]); }
+
+  void resize(size_t n) {
+    own();
+    storage.resize(n);
+    update();
+  }
+
+  void reserve(size_t n) {
+    own();
+    storage.reserve(n);
+    update();
+  }
+
+  void clear() {
+    owner.reset();
+    storage.clear();
+    update();
+  }
+
+  void push_back(const T &value) {
+    own();
+    storage.push_back(value);
+    update();
+  }
+
+  template <typename Iterator> void assign(Iterator first, Iterator last) {
+    own();
+    storage.assign(first, last);
+    update();
+  }
+
+  void swap(Buffer &other) {
+    storage.swap(other.storage);
+    owner.swap(other.owner);
+    std::swap(items, other.items);
+    std::swap(count, other.count);
+  }
+
+  void view(const T *_items, size_t _count,
+            std::shared_ptr<const void> _owner) {
+    std::vector<T>().swap(storage);
+    owner = _owner;
+    items = _items;
+    count = _count;
+  }
+
+private:
+  std::vector<T> storage;
+  std::shared_ptr<const void> owner;
+  const T *items = nullptr;
+  size_t count = 0;
+
+  // writing to a view copies it first
+  void own() {
+    if (!owner)
+      return;
+    storage.assign(items, items + count);
+    owner.reset();
+  }
+
+  void update() {
+    items = storage.data();
+    count = storage.size();
+  }
+};
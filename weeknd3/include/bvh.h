@@ -1,95 +1,304 @@
 #pragma once
 #include "aabb.h"
 #include "hittable.h"
+#include "parallel.h"
+#include "trace.h"
 #include <algorithm>
 
 class BVHNode : public Hittable {
 public:
-  BVHNode(HittableList list) : BVHNode(list.objects, 0, list.objects.size()) {
-    // There's a C++ subtlety here. This constructor (without span indices)
-    // creates an implicit copy of the hittable list, which we will modify. The
-    // lifetime of the copied list only extends until this constructor exits.
-    // That's OK, because we only need to persist the resulting bounding volume
-    // hierarchy.
+  BVHNode(const HittableList &list) : BVHNode(list.objects) {}
+
+  // the objects are reordered so that every leaf covers a contiguous range
+  BVHNode(std::vector<shared_ptr<Hittable>> objects)
+      : primitives(make_shared<std::vector<shared_ptr<Hittable>>>(
+            std::move(objects))) {
+    TraceSpan span("build bvh", "objects", (long long)primitives->size());
+    if (!primitives->empty())
+      build(0, primitives->size());
   }
 
   // build from top to bottom
   // another way is to build from bottom and can be parallelized
-  BVHNode(std::vector<shared_ptr<Hittable>> &objects, size_t start,
-          size_t end) {
+  BVHNode(shared_ptr<std::vector<shared_ptr<Hittable>>> _primitives,
+          size_t start, size_t end)
+      : primitives(_primitives) {
+    build(start, end);
+  }
+
+  virtual bool hit(const Ray &r, const Interval &ray_t,
+                   HitRecord &rec) const override {
+    RENDER_STAT(bvh_nodes);
+    // boxes of moving objects are only tight at the time of the ray
+    bool is_box_hit = is_moving
+                          ? AABB::hit_moving(bbox_begin, bbox_end, r, ray_t)
+                          : bbox.hit(r, ray_t);
+    if (!is_box_hit)
+      return false;
+
+    if (is_leaf()) {
+      bool is_hit = false;
+      auto closest = ray_t.max;
+      const auto *leaf = primitives->data() + first;
+      for (uint32_t k = 0; k < count; ++k) {
+        if (leaf[k]->hit(r, Interval(ray_t.min, closest), rec)) {
+          is_hit = true;
+          closest = rec.t;
+        }
+      }
+      return is_hit;
+    }
+
+    bool hit_left = left->hit(r, ray_t, rec);
+    bool hit_right = right->hit(
+        r, Interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+    return hit_left || hit_right;
+  }
+
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    RENDER_STAT_ADD(bvh_nodes, packet.active_count());
+    // lanes have different times, so packets test the box of the whole
+    // shutter interval
+    bool mask[RayPacket::size];
+    if (!bbox.hit_packet(packet, t_min, hits.t_max, mask))
+      return;
+
+    // lanes that miss this box do not go further down
+    bool is_same = true;
+    for (int lane = 0; lane < RayPacket::size; ++lane)
+      is_same &= mask[lane] == packet.active[lane];
+    RayPacket masked;
+    if (!is_same) {
+      masked = packet;
+      std::copy(mask, mask + RayPacket::size, masked.active);
+    }
+    const auto &children_packet = is_same ? packet : masked;
+
+    if (is_leaf()) {
+      const auto *leaf = primitives->data() + first;
+      for (uint32_t k = 0; k < count; ++k)
+        leaf[k]->hit_packet(children_packet, t_min, hits);
+      return;
+    }
+    left->hit_packet(children_packet, t_min, hits);
+    right->hit_packet(children_packet, t_min, hits);
+  }
+
+  virtual AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
+  double intersection_cost() const override { return sah_cost(); }
+
+  // recompute the bounds bottom-up after primitives moved, keeping the tree
+  // the subtrees below the top few levels are refit in parallel
+  // a hierarchy above this node keeps its old bounds, so only the root of
+  // what is rendered may be refit, which DynamicBVH makes sure of
+  void refit(int threads = 0) {
+    threads = get_thread_count(threads);
+    std::vector<BVHNode *> top, subtrees;
+    int depth = 0;
+    while ((1 << depth) < 4 * threads)
+      ++depth;
+    split_top(depth, top, subtrees);
+    parallel_for(
+        0, int(subtrees.size()),
+        [&](int index) { subtrees[index]->refit_subtree(); }, threads);
+    // children come after their parent in top
+    for (auto node = top.rbegin(); node != top.rend(); ++node)
+      (*node)->update_bbox();
+  }
+
+  // expected cost of a random ray through the tree relative to hitting the
+  // root box (surface area heuristic), grows as refitting loosens the bounds
+  double sah_cost() const {
+    auto area = bbox.surface_area();
+    return area > 0 ? subtree_cost() / area : 0;
+  }
+
+private:
+  // all the primitives of the tree in leaf order, shared by its nodes
+  shared_ptr<std::vector<shared_ptr<Hittable>>> primitives;
+  // null in leaves
+  shared_ptr<BVHNode> left;
+  shared_ptr<BVHNode> right;
+  // the range of primitives of a leaf and the sum of their intersection costs
+  uint32_t first = 0, count = 0;
+  double leaf_cost = 0;
+  AABB bbox;
+  // bounds at shutter open and close, interpolated by hit()
+  AABB bbox_begin, bbox_end;
+  bool is_moving = false;
+
+  static const size_t max_leaf_size = 4;
+  static constexpr double traversal_cost = 1;
+
+  bool is_leaf() const { return !left; }
+
+  void build(size_t start, size_t end) {
     // object median split here, which is quite good(at least better than space
     // median split)
+    auto &objects = *primitives;
     bbox = AABB::get_empty();
     // only iterate the objects that needs to sort
-    for (size_t index = start; index < end; ++index) {
+    for (size_t index = start; index < end; ++index)
       bbox = AABB(bbox, objects[index]->get_bbox());
-    }
     int axis = bbox.longest_axis();
     auto comparator = (axis == 0)
                           ? box_x_compare
                           : ((axis == 1) ? box_y_compare : box_z_compare);
 
     size_t span = end - start;
-    if (span == 1) {
-      // only 1 object, no need to build a tree
-      left = right = objects[start];
-    } else if (span == 2) {
-      // only 2 objects, build a simple tree
-      left = objects[start];
-      right = objects[start + 1];
-    } else {
-      auto mid = start + span / 2;
-      // std::sort(std::begin(objects) + start, std::begin(objects) + end,
-      //           comparator);
+    auto mid = start + span / 2;
+    if (span > 1)
       std::nth_element(std::begin(objects) + start, std::begin(objects) + mid,
                        std::begin(objects) + end, comparator);
 
-      left = make_shared<BVHNode>(objects, start, mid);
-      right = make_shared<BVHNode>(objects, mid, end);
+    // small ranges stay one leaf unless splitting them is cheaper
+    if (span <= 1 || (span <= max_leaf_size &&
+                      range_cost(start, end) <= split_cost(start, mid, end))) {
+      first = uint32_t(start);
+      count = uint32_t(span);
+      leaf_cost = range_cost(start, end);
+    } else {
+      left = make_shared<BVHNode>(primitives, start, mid);
+      right = make_shared<BVHNode>(primitives, mid, end);
     }
+    update_bbox();
+  }
 
-    // bbox = AABB(left->get_bbox(), right->get_bbox());
+  // surface area heuristic costs once this node is entered
+  double range_cost(size_t start, size_t end) const {
+    double cost = 0;
+    for (auto index = start; index < end; ++index)
+      cost += (*primitives)[index]->intersection_cost();
+    return cost;
   }
 
-  virtual bool hit(const Ray &r, const Interval &ray_t,
-                   HitRecord &rec) const override {
-    if (!bbox.hit(r, ray_t))
-      return false;
+  double split_cost(size_t start, size_t mid, size_t end) const {
+    const auto &objects = *primitives;
+    AABB left_box, right_box;
+    for (auto index = start; index < mid; ++index)
+      left_box = AABB(left_box, objects[index]->get_bbox());
+    for (auto index = mid; index < end; ++index)
+      right_box = AABB(right_box, objects[index]->get_bbox());
+    auto area = bbox.surface_area();
+    if (area <= 0)
+      return infinity;
+    // both child boxes are tested
+    return 2 * traversal_cost +
+           (left_box.surface_area() * range_cost(start, mid) +
+            right_box.surface_area() * range_cost(mid, end)) /
+               area;
+  }
 
-    // if the leaves are reached(exactly spheres), enter ray-tracing calculation
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right = right->hit(
-        r, Interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+  void update_bbox() {
+    if (is_leaf()) {
+      bbox = bbox_begin = bbox_end = AABB::get_empty();
+      for (auto index = first; index < first + count; ++index) {
+        const auto &object = (*primitives)[index];
+        bbox = AABB(bbox, object->get_bbox());
+        bbox_begin = AABB(bbox_begin, object->get_bbox_begin());
+        bbox_end = AABB(bbox_end, object->get_bbox_end());
+      }
+    } else {
+      bbox = AABB(left->get_bbox(), right->get_bbox());
+      bbox_begin = AABB(left->get_bbox_begin(), right->get_bbox_begin());
+      bbox_end = AABB(left->get_bbox_end(), right->get_bbox_end());
+    }
+    is_moving = !(bbox_begin == bbox_end);
+  }
 
-    return hit_left || hit_right;
+  void refit_subtree() {
+    if (!is_leaf()) {
+      left->refit_subtree();
+      right->refit_subtree();
+    }
+    update_bbox();
   }
 
-  virtual AABB get_bbox() const override { return bbox; }
+  // nodes above depth in top (parents first), the subtrees below in subtrees
+  void split_top(int depth, std::vector<BVHNode *> &top,
+                 std::vector<BVHNode *> &subtrees) {
+    if (depth == 0 || is_leaf()) {
+      subtrees.push_back(this);
+      return;
+    }
+    top.push_back(this);
+    left->split_top(depth - 1, top, subtrees);
+    right->split_top(depth - 1, top, subtrees);
+  }
 
-private:
-  shared_ptr<Hittable> left;
-  shared_ptr<Hittable> right;
-  AABB bbox;
+  // the area of a box is proportional to the chance a ray hits it
+  double subtree_cost() const {
+    auto area = bbox.surface_area();
+    if (is_leaf())
+      return area * (traversal_cost + leaf_cost);
+    return area * traversal_cost + left->subtree_cost() +
+           right->subtree_cost();
+  }
 
-  static inline bool box_compare(const shared_ptr<Hittable> a,
-                                 const shared_ptr<Hittable> b, int axis_index) {
+  static inline bool box_compare(const shared_ptr<Hittable> &a,
+                                 const shared_ptr<Hittable> &b,
+                                 int axis_index) {
     auto a_axis_interval = a->get_bbox().axis_interval(axis_index);
     auto b_axis_interval = b->get_bbox().axis_interval(axis_index);
     return a_axis_interval.min < b_axis_interval.min;
   }
 
-  static bool box_x_compare(const shared_ptr<Hittable> a,
-                            const shared_ptr<Hittable> b) {
+  static bool box_x_compare(const shared_ptr<Hittable> &a,
+                            const shared_ptr<Hittable> &b) {
     return box_compare(a, b, 0);
   }
 
-  static bool box_y_compare(const shared_ptr<Hittable> a,
-                            const shared_ptr<Hittable> b) {
+  static bool box_y_compare(const shared_ptr<Hittable> &a,
+                            const shared_ptr<Hittable> &b) {
     return box_compare(a, b, 1);
   }
 
-  static bool box_z_compare(const shared_ptr<Hittable> a,
-                            const shared_ptr<Hittable> b) {
+  static bool box_z_compare(const shared_ptr<Hittable> &a,
+                            const shared_ptr<Hittable> &b) {
     return box_compare(a, b, 2);
   }
 };
+
+// bvh over primitives that move between frames
+// update() refits the existing tree, which is much cheaper than a build but
+// lets the bounds overlap more and more, so the tree is rebuilt from scratch
+// once its sah cost has grown by rebuild_ratio since the last build
+// a refit cannot reach the bounds of an enclosing hierarchy, so the tree
+// must be the root: this is not a Hittable and cannot be added to a list or
+// a bvh, get_root() is what is rendered and it changes with a rebuild
+class DynamicBVH {
+public:
+  DynamicBVH(const HittableList &list, double _rebuild_ratio = 1.5)
+      : objects(list.objects), rebuild_ratio(_rebuild_ratio) {
+    rebuild();
+  }
+
+  // call after moving primitives, true if the tree was rebuilt
+  bool update(int threads = 0) {
+    root->refit(threads);
+    if (root->sah_cost() <= rebuild_ratio * build_cost)
+      return false;
+    rebuild();
+    return true;
+  }
+
+  const BVHNode &get_root() const { return *root; }
+  double get_rebuild_ratio() const { return rebuild_ratio; }
+  double get_build_cost() const { return build_cost; }
+  double get_cost() const { return root->sah_cost(); }
+
+private:
+  std::vector<shared_ptr<Hittable>> objects;
+  shared_ptr<BVHNode> root;
+  double rebuild_ratio;
+  double build_cost = 0;
+
+  void rebuild() {
+    root = make_shared<BVHNode>(objects);
+    build_cost = root->sah_cost();
+  }
+};
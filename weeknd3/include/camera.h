@@ -1,8 +1,26 @@
 #pragma once
 
+#include "denoiser.h"
+#include "framebuffer.h"
+#include "heatmap.h"
 #include "hittable.h"
 #include "material.h"
+#include "parallel.h"
 #include "pdf.h"
+#include "sampler.h"
+#include "stats.h"
+#include "trace.h"
+#include "wavefront.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// rays intersected with the scene by the calling thread
+inline long long &thread_ray_count() {
+  static thread_local long long count = 0;
+  return count;
+}
 
 class Camera {
 
@@ -36,6 +54,42 @@ class Camera {
 
   color background; // Scene background color
   const Hittable &lights;
+  // probability of sampling towards the lights instead of the material
+  double light_mix_rate = 0.5;
+
+  // low-discrepancy sampling
+  // dimensions of a sample: 0-1 pixel offset, 2-3 defocus disk, 4 time, and
+  // then 3 per bounce (1 for light/material choice, 2 for the direction)
+  SamplerType sampler_type = SamplerType::Sobol;
+  // every random value of a render derives from it and the pixel, sample and
+  // dimension, so the image is the same whatever the threads and row order
+  uint32_t seed = 0;
+  static const int camera_dimensions = 5;
+  static const int bounce_dimensions = 3;
+
+  // post-process the linear framebuffer with an edge-aware filter
+  bool denoise = false;
+  // write the aovs as float images if not empty
+  std::string aov_prefix;
+
+  IntegratorType integrator = IntegratorType::Recursive;
+  // paths in flight at once for the wavefront integrator
+  int wavefront_batch_size = 1 << 18;
+  bool sort_rays = false;
+  // trace camera rays of neighbouring pixels as packets (recursive only)
+  bool packet_tracing = false;
+  // rows rendered in parallel, 0 for one thread per hardware thread
+  // the wavefront integrator runs on one thread
+  int threads = 1;
+  // rays intersected with the scene by the last render
+  long long rays_traced = 0;
+  // counters of the last render, only counted when built with RENDER_STATS
+  RenderStats stats;
+  // write the counters as json if not empty
+  std::string stats_output;
+  // write the per-pixel cost as a false-color ppm if not empty
+  std::string heatmap_output;
+  CostMetric heatmap_metric = CostMetric::Time;
 
   void initialize() {
     // Camera
@@ -86,6 +140,8 @@ class Camera {
         focus_dist * (floating)std::tan(degrees2radians(defocus_angle / 2));
     defocus_disk_u = u * defocus_radius;
     defocus_disk_v = v * defocus_radius;
+
+    light_mix_rate = get_light_mix_rate(lights);
   }
 
   // light sampling:
@@ -95,72 +151,327 @@ class Camera {
   // 4. https://zhuanlan.zhihu.com/p/508136071
   // 5. the direction may be blocked by other objects
 
-  color ray_color(const Ray &r, const int depth, const Hittable &objects) const {
+  // aov is only passed for camera rays to record their first hit
+  color ray_color(const Ray &r, const int depth, const Hittable &objects,
+                  Sampler &sampler, AOVSample *aov = nullptr) const {
     if (depth <= 0) {
       // this ray has experienced so much intersection, it should be so dark
+      RENDER_STAT(depth_limit_terminations);
+      RENDER_STAT_PATH(max_depth);
       return color(0., 0., 0.);
     }
     HitRecord rec;
+    key_intersection(depth, sampler);
+    ++thread_ray_count();
+    if (depth == max_depth)
+      RENDER_STAT(camera_rays);
+    else
+      RENDER_STAT(bounce_rays);
     if (objects.hit(r, Interval::get_positive(), rec)) {
-      ISRecord srec;
-      color emitted_color = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
-      // if hit a light, scatter() will return false and terminate the recursion
-      if (rec.mat->scatter(r, rec, srec)) {
-        if (srec.is_direction_determined) {
-          return srec.attenuation *
-                 ray_color(srec.skip_pdf_ray, depth - 1, objects);
-        }
-        // sample towards light
-        auto p0 = make_shared<HittablePDF>(lights, rec.p);
-        // sample towards material property
-        MixturePDF mixed_pdf(p0, srec.pdf_ptr);
-
-        Ray scattered = Ray(rec.p, mixed_pdf.generate(), r.time());
-        double pdf_value = mixed_pdf.value(scattered.direction());
-        double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
-
-        return emitted_color +
-               (srec.attenuation * scatter_pdf *
-                ray_color(scattered, depth - 1, objects)) /
-                   pdf_value;
-      }
-      return emitted_color;
+      rec.finalize(r);
+      return shade(r, rec, depth, objects, sampler, aov);
     }
 
     // background color
+    RENDER_STAT_PATH(max_depth - depth + 1);
     return background;
   }
 
-  Ray get_ray(int i, int j) const {
+  // media draw from the random stream while a ray is intersected, every
+  // integrator keys it by the depth of the ray so that their renders agree
+  void key_intersection(const int depth, Sampler &sampler) const {
+    sampler.set_dimension(camera_dimensions +
+                          bounce_dimensions * (max_depth - depth));
+    sampler.key_random(1);
+  }
+
+  // the part of ray_color after the closest hit is found
+  color shade(const Ray &r, const HitRecord &rec, const int depth,
+              const Hittable &objects, Sampler &sampler,
+              AOVSample *aov = nullptr) const {
+    RENDER_STAT(hits);
+    ISRecord srec;
+    sampler.set_dimension(camera_dimensions +
+                          bounce_dimensions * (max_depth - depth));
+    color emitted_color = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+    // if hit a light, scatter() will return false and terminate the recursion
+    bool is_scattered = rec.mat->scatter(r, rec, srec);
+    if (aov) {
+      aov->albedo = is_scattered ? srec.attenuation : color(1, 1, 1);
+      aov->normal = rec.normal;
+      aov->depth = rec.t * glm::length(r.direction());
+      aov->material_id = rec.mat->get_id();
+      aov->object_id = rec.object_id;
+    }
+    if (is_scattered) {
+      if (srec.is_direction_determined) {
+        return srec.attenuation *
+               ray_color(srec.skip_pdf_ray, depth - 1, objects, sampler);
+      }
+      // sample towards light
+      auto p0 = make_pdf<HittablePDF>(lights, rec.p);
+      // sample towards material property
+      MixturePDF mixed_pdf(p0, srec.pdf_ptr, light_mix_rate);
+
+      Ray scattered = Ray(rec.p, mixed_pdf.generate(sampler), r.time());
+      double pdf_value = mixed_pdf.value(scattered.direction());
+      double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+      return emitted_color +
+             (srec.attenuation * scatter_pdf *
+              ray_color(scattered, depth - 1, objects, sampler)) /
+                 pdf_value;
+    }
+    RENDER_STAT_PATH(max_depth - depth + 1);
+    return emitted_color;
+  }
+
+  Ray get_ray(int i, int j, Sampler &sampler) const {
     // Construct a camera ray originating from the origin and directed at
     // randomly sampled point around the pixel location i, j.
 
-    auto offset = sample_square();
+    auto offset = sample_square(sampler);
     auto pixel_sample = pixel00_loc + ((i + offset.x) * pixel_delta_u) +
                         ((j + offset.y) * pixel_delta_v);
 
     // from camera to sample position
     // Construct a camera ray originating from the defocus disk and directed at
     // a randomly sampled point around the pixel location i, j.
-    auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+    auto disk_sample = sampler.get_2d();
+    auto ray_origin =
+        (defocus_angle <= 0) ? center : defocus_disk_sample(disk_sample);
     auto ray_direction = pixel_sample - ray_origin;
-    auto ray_time = random_double();
+    auto ray_time = sampler.get_1d();
 
     return Ray(ray_origin, ray_direction, ray_time);
   }
 
-  vec2 sample_square() const {
+  vec2 sample_square(Sampler &sampler) const {
     // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit
     // square.
-    return vec2(random_double() - 0.5, random_double() - 0.5);
+    return sampler.get_2d() - vec2(0.5, 0.5);
   }
 
-  vec3 defocus_disk_sample() const {
+  vec3 defocus_disk_sample(const vec2 &sample) const {
     // Returns a random point in the camera defocus disk.
-    auto p = random_in_unit_circle();
+    auto p = random_in_unit_circle(sample);
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
+  // rows are handed out to the threads, each row gets its own sampler
+  void for_each_row(const std::function<void(int, Sampler &)> &render_row) {
+    std::atomic<int> finished(0);
+    std::atomic<long long> rays(0);
+    std::mutex stats_mutex;
+    parallel_for(
+        0, image_height,
+        [&](int j) {
+          TraceSpan span("row", "row", j);
+          auto sampler = make_sampler(sampler_type, seed);
+          auto rays_before = thread_ray_count();
+          if (RenderStats::enabled)
+            thread_stats() = RenderStats();
+          render_row(j, *sampler);
+          rays += thread_ray_count() - rays_before;
+          if (RenderStats::enabled) {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats.add(thread_stats());
+          }
+          // one write, so that lines of different threads do not mix
+          std::clog << "finish " + std::to_string(++finished) + " lines\r"
+                    << std::flush;
+        },
+        threads);
+    rays_traced = rays;
+  }
+
+  void render_recursive(const Hittable &objects, FrameBuffer &fb) {
+    for_each_row([&](int j, Sampler &sampler) {
+      for (int i = 0; i < image_width; ++i) {
+        color final_color(0., 0., 0.);
+        color albedo(0., 0., 0.);
+        vec3 normal(0., 0., 0.);
+        double depth = 0.;
+        auto pixel_begin = std::chrono::steady_clock::now();
+        auto steps_before = thread_stats().steps();
+        sampler.start_pixel(i, j);
+
+        for (int sample = 0; sample < samples_per_pixel; ++sample) {
+          sampler.start_sample(sample);
+          Ray r = get_ray(i, j, sampler);
+          AOVSample aov;
+          final_color += ray_color(r, max_depth, objects, sampler, &aov);
+          albedo += aov.albedo;
+          normal += aov.normal;
+          depth += aov.depth;
+          if (sample == 0) {
+            fb.material_id.at(i, j) = aov.material_id;
+            fb.object_id.at(i, j) = aov.object_id;
+          }
+        }
+
+        // remember the weight
+        fb.beauty.at(i, j) = final_color * pixel_sample_scale;
+        fb.albedo.at(i, j) = albedo * pixel_sample_scale;
+        fb.normal.at(i, j) = normal * pixel_sample_scale;
+        fb.depth.at(i, j) = depth * pixel_sample_scale;
+        fb.sample_count.at(i, j) = samples_per_pixel;
+        fb.time.at(i, j) = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - pixel_begin)
+                               .count();
+        if (RenderStats::enabled)
+          fb.steps.at(i, j) = double(thread_stats().steps() - steps_before);
+      }
+    });
+  }
+
+  // same as render_recursive, but the camera rays of PACKET_SIZE pixels in a
+  // row are intersected together, the bounces are traced one by one
+  void render_packets(const Hittable &objects, FrameBuffer &fb) {
+    const int N = RayPacket::size;
+    for_each_row([&](int j, Sampler &sampler) {
+      for (int i0 = 0; i0 < image_width; i0 += N) {
+        const int lanes = std::min(N, image_width - i0);
+        color final_color[N], albedo[N];
+        vec3 normal[N];
+        double depth[N];
+        for (int lane = 0; lane < lanes; ++lane) {
+          final_color[lane] = albedo[lane] = color(0., 0., 0.);
+          normal[lane] = vec3(0., 0., 0.);
+          depth[lane] = 0.;
+        }
+        auto packet_begin = std::chrono::steady_clock::now();
+        auto steps_before = thread_stats().steps();
+
+        for (int sample = 0; sample < samples_per_pixel; ++sample) {
+          RayPacket packet;
+          PacketHit hits;
+          for (int lane = 0; lane < lanes; ++lane) {
+            sampler.start_pixel(i0 + lane, j);
+            sampler.start_sample(sample);
+            packet.set(lane, get_ray(i0 + lane, j, sampler));
+            key_intersection(max_depth, sampler);
+            hits.random[lane] = thread_random();
+          }
+          if (max_depth > 0) {
+            objects.hit_packet(packet, Interval::get_positive().min, hits);
+            thread_ray_count() += lanes;
+            RENDER_STAT_ADD(camera_rays, lanes);
+          }
+          for (int lane = 0; lane < lanes; ++lane)
+            if (hits.is_hit[lane])
+              hits.rec[lane].finalize(packet.ray(lane));
+
+          for (int lane = 0; lane < lanes; ++lane) {
+            // the sampler replays the dimensions get_ray has consumed
+            sampler.start_pixel(i0 + lane, j);
+            sampler.start_sample(sample);
+            AOVSample aov;
+            if (max_depth > 0 && !hits.is_hit[lane])
+              RENDER_STAT_PATH(1);
+            if (max_depth > 0)
+              final_color[lane] +=
+                  hits.is_hit[lane]
+                      ? shade(packet.ray(lane), hits.rec[lane], max_depth,
+                              objects, sampler, &aov)
+                      : background;
+            albedo[lane] += aov.albedo;
+            normal[lane] += aov.normal;
+            depth[lane] += aov.depth;
+            if (sample == 0) {
+              fb.material_id.at(i0 + lane, j) = aov.material_id;
+              fb.object_id.at(i0 + lane, j) = aov.object_id;
+            }
+          }
+        }
+
+        // the time of a packet is shared by its pixels
+        auto pixel_time = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - packet_begin)
+                              .count() /
+                          lanes;
+        auto pixel_steps =
+            double(thread_stats().steps() - steps_before) / lanes;
+        for (int lane = 0; lane < lanes; ++lane) {
+          const int i = i0 + lane;
+          fb.beauty.at(i, j) = final_color[lane] * pixel_sample_scale;
+          fb.albedo.at(i, j) = albedo[lane] * pixel_sample_scale;
+          fb.normal.at(i, j) = normal[lane] * pixel_sample_scale;
+          fb.depth.at(i, j) = depth[lane] * pixel_sample_scale;
+          fb.sample_count.at(i, j) = samples_per_pixel;
+          fb.time.at(i, j) = pixel_time;
+          if (RenderStats::enabled)
+            fb.steps.at(i, j) = pixel_steps;
+        }
+      }
+    });
+  }
+
+  void render_wavefront(const Hittable &objects, FrameBuffer &fb) {
+    auto sampler = make_sampler(sampler_type, seed);
+    WavefrontIntegrator integrator(lights, background, max_depth,
+                                   camera_dimensions, bounce_dimensions);
+    integrator.set_ray_sorting(sort_rays);
+    const long long total =
+        (long long)image_width * image_height * samples_per_pixel;
+    if (RenderStats::enabled)
+      thread_stats() = RenderStats();
+
+    // pixels are enqueued in scanline order with all their samples
+    for (long long begin = 0; begin < total; begin += wavefront_batch_size) {
+      std::clog << "finish " << (100 * begin / total) << "%\r" << std::flush;
+      TraceSpan span("wavefront batch", "first path", begin);
+      auto end = std::min(total, begin + wavefront_batch_size);
+      for (auto index = begin; index < end; ++index) {
+        const int pixel = int(index / samples_per_pixel);
+        const int sample = int(index % samples_per_pixel);
+        const int i = pixel % image_width;
+        const int j = pixel / image_width;
+        sampler->start_pixel(i, j);
+        sampler->start_sample(sample);
+        integrator.push_camera_ray(get_ray(i, j, *sampler), pixel, sample);
+      }
+      integrator.trace(objects, fb, *sampler);
+    }
+    std::clog << std::endl;
+    integrator.get_stats().report(std::clog);
+    rays_traced = integrator.get_stats().rays;
+    stats.add(thread_stats());
+
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        fb.beauty.at(i, j) *= pixel_sample_scale;
+        fb.albedo.at(i, j) *= pixel_sample_scale;
+        fb.normal.at(i, j) *= pixel_sample_scale;
+        fb.depth.at(i, j) *= pixel_sample_scale;
+        fb.sample_count.at(i, j) = samples_per_pixel;
+      }
+    }
+  }
+
+  void output_heatmap(const FrameBuffer &fb) const {
+    if (integrator == IntegratorType::Wavefront) {
+      std::cerr << "ERROR: the wavefront integrator records no per-pixel "
+                   "cost for the heatmap.\n";
+      return;
+    }
+    if (heatmap_metric == CostMetric::Steps && !RenderStats::enabled) {
+      std::cerr << "ERROR: the steps heatmap needs a build with "
+                   "-DRENDER_STATS=ON.\n";
+      return;
+    }
+    TraceSpan span("write heatmap");
+    double max_cost;
+    if (!write_heatmap(heatmap_output, get_cost(fb, heatmap_metric),
+                         max_cost)) {
+      std::cerr << "ERROR: could not write '" << heatmap_output << "'.\n";
+      return;
+    }
+    std::clog << "\nheatmap: brightest at " << max_cost << " "
+              << get_cost_unit(heatmap_metric) << " per pixel\n";
+    report_cost_by_object(std::clog, fb, heatmap_metric);
+  }
+
 public:
   // Camera() { initialize(); }
   Camera(const int _width, const int _height, const Hittable &_lights,
@@ -177,21 +488,106 @@ public:
     initialize();
   }
 
+  void set_sampler(SamplerType type) { sampler_type = type; }
+
+  void set_seed(uint32_t _seed) { seed = _seed; }
+
+  void set_denoise(bool _denoise) { denoise = _denoise; }
+
+  void set_aov_output(const std::string &prefix) { aov_prefix = prefix; }
+
+  void set_integrator(IntegratorType type) { integrator = type; }
+
+  // only used by the wavefront integrator
+  void set_ray_sorting(bool _sort_rays) { sort_rays = _sort_rays; }
+
+  void set_packet_tracing(bool _packet_tracing) {
+    packet_tracing = _packet_tracing;
+  }
+
+  void set_threads(int _threads) { threads = _threads; }
+
+  // the steps metric needs a build with -DRENDER_STATS=ON, the wavefront
+  // integrator records no per-pixel cost
+  void set_heatmap_output(const std::string &filename,
+                          CostMetric metric = CostMetric::Time) {
+    heatmap_output = filename;
+    heatmap_metric = metric;
+  }
+
+  // needs a build with -DRENDER_STATS=ON
+  void set_stats_output(const std::string &filename) {
+    stats_output = filename;
+  }
+
+  // overrides of the scene's settings, e.g. for benchmarks
+  void set_image_size(int width, int height) {
+    image_width = width;
+    image_height = height;
+    initialize();
+  }
+
+  void set_samples_per_pixel(int spp) {
+    samples_per_pixel = spp;
+    initialize();
+  }
+
+  int get_image_width() const { return image_width; }
+  int get_image_height() const { return image_height; }
+  int get_samples_per_pixel() const { return samples_per_pixel; }
+  long long get_rays_traced() const { return rays_traced; }
+  const RenderStats &get_stats() const { return stats; }
+
+  // renders into an image of the camera's size and writes it as ppm
   void render(const Hittable &objects) {
+    FrameBuffer fb(image_width, image_height);
+    render(objects, fb);
+
+    TraceSpan span("write image");
     std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-    for (int j = 0; j < image_height; ++j) {
-      std::clog << "finish " << j << " lines\r" << std::flush;
-      for (int i = 0; i < image_width; ++i) {
-        color final_color(0., 0., 0.);
+    for (int j = 0; j < image_height; ++j)
+      for (int i = 0; i < image_width; ++i)
+        write_color(std::cout, fb.beauty.at(i, j));
+  }
 
-        for (int sample = 0; sample < samples_per_pixel; ++sample) {
-          Ray r = get_ray(i, j);
-          final_color += ray_color(r, max_depth, objects);
-        }
+  // without writing the image, fb must have the camera's size
+  void render(const Hittable &objects, FrameBuffer &fb) {
+    rays_traced = 0;
+    stats = RenderStats();
+    {
+      TraceSpan span("render");
+      if (integrator == IntegratorType::Wavefront)
+        render_wavefront(objects, fb);
+      else if (packet_tracing)
+        render_packets(objects, fb);
+      else
+        render_recursive(objects, fb);
+    }
 
-        // remember the weight
-        write_color(std::cout, final_color * pixel_sample_scale);
-      }
+    // before denoising, so that the color aov is the raw estimate
+    if (!aov_prefix.empty()) {
+      TraceSpan span("write aovs");
+      if (!fb.write_aovs(aov_prefix))
+        std::cerr << "\nfailed to write aovs to " << aov_prefix << std::endl;
+    }
+
+    if (!heatmap_output.empty())
+      output_heatmap(fb);
+
+    if (denoise) {
+      TraceSpan span("denoise");
+      std::clog << "\ndenoising" << std::flush;
+      Denoiser().denoise(fb);
+    }
+
+    if (RenderStats::enabled) {
+      std::clog << std::endl;
+      stats.report(std::clog);
+      if (!stats_output.empty() && !stats.write_json(stats_output))
+        std::cerr << "ERROR: could not write '" << stats_output << "'.\n";
+    } else if (!stats_output.empty()) {
+      std::cerr << "ERROR: no counters to write to '" << stats_output
+                << "', build with -DRENDER_STATS=ON.\n";
     }
   }
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "fast_math.h"
+#include <cstdint>
 #include <cstdlib>
 #include <glm/glm.hpp>
 #include <iostream>
@@ -22,17 +24,47 @@ using color = vec3;
 using std::make_shared;
 using std::shared_ptr;
 
-const vec3 QUAD_LIGHT_MIN = vec3(213, 554, 227);
-const vec3 QUAD_LIGHT_MAX = vec3(343, 554, 332);
-
 const double infinity = std::numeric_limits<double>::infinity();
 const double PI = 3.141592653589;
 
 inline double degrees2radians(double degrees) { return degrees * PI / 180.0; }
 
+// random numbers of the calling thread: the n-th number of a stream is a
+// hash of its key and n, so it depends on nothing but the last seed_random()
+// samplers key the stream by (seed, pixel, sample, dimension), which makes
+// whatever materials and media draw independent of the thread and the order
+// a path is traced in, unlike the global std::rand() sequence
+class RandomStream {
+public:
+  void seed(uint64_t _key) {
+    key = mix(_key);
+    counter = 0;
+  }
+
+  // splitmix64: a weyl sequence started at the hashed key
+  uint64_t next() { return mix(key + ++counter * 0x9e3779b97f4a7c15ull); }
+
+private:
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t key = 0;
+  uint64_t counter = 0;
+};
+
+inline RandomStream &thread_random() {
+  static thread_local RandomStream stream;
+  return stream;
+}
+
+inline void seed_random(uint64_t key) { thread_random().seed(key); }
+
 inline double random_double() {
-  // Returns a random real in [0,1).
-  return std::rand() / (RAND_MAX + 1.0);
+  // Returns a random real in [0,1), 53 random bits.
+  return (thread_random().next() >> 11) * 0x1p-53;
 }
 
 inline double random_double(double min, double max) {
@@ -92,6 +124,36 @@ inline vec3 random_in_unit_circle() {
   }
 }
 
+// map a point of the unit square onto the unit disk
+// concentric mapping (Shirley & Chiu) keeps the stratification of the sample,
+// which the rejection method above cannot do
+inline vec3 random_in_unit_circle(const vec2 &sample) {
+  auto a = 2 * sample.x - 1;
+  auto b = 2 * sample.y - 1;
+  if (a == 0 && b == 0)
+    return vec3(0, 0, 0);
+  double r, theta;
+  if (std::fabs(a) > std::fabs(b)) {
+    r = a;
+    theta = (PI / 4) * (b / a);
+  } else {
+    r = b;
+    theta = PI / 2 - (PI / 4) * (a / b);
+  }
+  double sin_theta, cos_theta;
+  fast_sincos(theta, sin_theta, cos_theta);
+  return vec3(r * cos_theta, r * sin_theta, 0);
+}
+
+// uniform direction on the unit sphere from a point of the unit square
+inline vec3 random_unit_vec3(const vec2 &sample) {
+  auto z = 1 - 2 * sample.x;
+  auto r = std::sqrt(std::fmax(0., 1 - z * z));
+  double sin_phi, cos_phi;
+  fast_sincos(2 * PI * sample.y, sin_phi, cos_phi);
+  return vec3(r * cos_phi, r * sin_phi, z);
+}
+
 inline floating trilinear_interp(const double c[2][2][2], const double u,
                                  const double v, const double w) {
   auto accum = 0.0;
@@ -125,17 +187,22 @@ inline floating perlin_interp(const vec3 c[2][2][2], const double u,
 
 // more Lambertian sampling
 // it is relative to z-axis but not normal!
-inline vec3 random_cosine_direction() {
-  auto r1 = random_double();
-  auto r2 = random_double();
-
-  auto phi = 2 * PI * r1;
-  auto x = std::cos(phi) * std::sqrt(r2);
-  auto y = std::sin(phi) * std::sqrt(r2);
+inline vec3 random_cosine_direction(const vec2 &sample) {
+  auto r1 = sample.x;
+  auto r2 = sample.y;
+
+  double sin_phi, cos_phi;
+  fast_sincos(2 * PI * r1, sin_phi, cos_phi);
+  auto x = cos_phi * std::sqrt(r2);
+  auto y = sin_phi * std::sqrt(r2);
   auto z = std::sqrt(1 - r2);
 
   return vec3(x, y, z);
 }
 
+inline vec3 random_cosine_direction() {
+  return random_cosine_direction(vec2(random_double(), random_double()));
+}
+
 #include "color.h"
 #include "interval.h"
@@ -0,0 +1,117 @@
+#pragma once
+#include "framebuffer.h"
+#include "parallel.h"
+
+// edge-avoiding a-trous wavelet filter
+// Dammertz et al., Edge-Avoiding A-Trous Wavelet Transform for fast Global
+// Illumination Filtering, HPG 2010
+// the 5x5 B3-spline kernel is applied with growing holes (1, 2, 4, ...), each
+// tap weighted by how similar color, normal and depth are to the center
+// texture detail is kept by filtering the irradiance (color / albedo) only
+class Denoiser {
+public:
+  Denoiser(const int _iterations = 5, const double _sigma_color = 1.,
+           const double _sigma_normal = 0.2, const double _sigma_depth = 0.1)
+      : iterations(_iterations), sigma_color(_sigma_color),
+        sigma_normal(_sigma_normal), sigma_depth(_sigma_depth) {}
+
+  void denoise(FrameBuffer &fb, const int threads = 0) const {
+    const int width = fb.get_width();
+    const int height = fb.get_height();
+    Image<color> irradiance(width, height);
+    Image<color> filtered(width, height);
+
+    // demodulate
+    parallel_for(
+        0, height,
+        [&](int j) {
+          for (int i = 0; i < width; ++i)
+            irradiance.at(i, j) = fb.beauty.at(i, j) / safe_albedo(fb, i, j);
+        },
+        threads);
+
+    auto sigma_c = sigma_color;
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+      const int step = 1 << iteration;
+      parallel_for(
+          0, height,
+          [&](int j) {
+            for (int i = 0; i < width; ++i)
+              filtered.at(i, j) = filter_pixel(fb, irradiance, i, j, step,
+                                               sigma_c);
+          },
+          threads);
+      irradiance.swap(filtered);
+      // finer levels carry less noise, so trust color differences more
+      sigma_c *= 0.5;
+    }
+
+    // remodulate
+    parallel_for(
+        0, height,
+        [&](int j) {
+          for (int i = 0; i < width; ++i)
+            fb.beauty.at(i, j) = irradiance.at(i, j) * safe_albedo(fb, i, j);
+        },
+        threads);
+  }
+
+private:
+  int iterations;
+  double sigma_color;
+  double sigma_normal;
+  double sigma_depth;
+
+  static color safe_albedo(const FrameBuffer &fb, int i, int j) {
+    static const double min_albedo = 1e-3;
+    auto a = fb.albedo.at(i, j);
+    return color(std::fmax(a.r, min_albedo), std::fmax(a.g, min_albedo),
+                 std::fmax(a.b, min_albedo));
+  }
+
+  color filter_pixel(const FrameBuffer &fb, const Image<color> &irradiance,
+                     int i, int j, int step, double sigma_c) const {
+    static const double kernel[5] = {1. / 16, 1. / 4, 3. / 8, 1. / 4, 1. / 16};
+    const int width = fb.get_width();
+    const int height = fb.get_height();
+
+    const auto &c_p = irradiance.at(i, j);
+    const auto &n_p = fb.normal.at(i, j);
+    const auto z_p = fb.depth.at(i, j);
+
+    color sum(0, 0, 0);
+    double weight_sum = 0;
+    for (int dy = -2; dy <= 2; ++dy) {
+      int y = j + dy * step;
+      if (y < 0 || y >= height)
+        continue;
+      for (int dx = -2; dx <= 2; ++dx) {
+        int x = i + dx * step;
+        if (x < 0 || x >= width)
+          continue;
+
+        const auto &c_q = irradiance.at(x, y);
+        auto dc = c_p - c_q;
+        auto w_color = std::exp(-glm::dot(dc, dc) / (sigma_c * sigma_c));
+
+        auto dn = n_p - fb.normal.at(x, y);
+        auto w_normal =
+            std::exp(-glm::dot(dn, dn) / (sigma_normal * sigma_normal));
+
+        // relative depth difference, so the scale of the scene does not matter
+        auto z_q = fb.depth.at(x, y);
+        auto z_max = std::fmax(z_p, z_q);
+        auto dz = z_max > 0 ? std::fabs(z_p - z_q) / z_max : 0.;
+        auto w_depth = std::exp(-dz / sigma_depth);
+
+        auto weight = kernel[dx + 2] * kernel[dy + 2] * w_color * w_normal *
+                      w_depth;
+        sum += weight * c_q;
+        weight_sum += weight;
+      }
+    }
+
+    // the center tap always has a positive weight
+    return sum / weight_sum;
+  }
+};
@@ -0,0 +1,168 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// polynomial approximations of the libm functions that are called for every
+// hit or sample, branch free so that loops over them can be vectorized
+// the renderer calls the fast_* functions below, which are the approximations
+// when built with -DFAST_MATH=ON and the std:: functions otherwise
+// error bounds were measured against long double over the whole input range
+
+namespace approx {
+
+const double pi = 3.14159265358979323846;
+const double pi_2 = 1.57079632679489661923;
+const double pi_4 = 0.78539816339744830962;
+const double ln2 = 0.69314718055994530942;
+
+// adding it rounds a double below 2^51 to an integer, which ends up in the
+// low bits of the sum
+const double round_magic = 6755399441055744.0;
+
+inline uint64_t to_bits(double x) {
+  uint64_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+inline double from_bits(uint64_t bits) {
+  double x;
+  std::memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// relative error < 3e-10, x is clamped to [-1022, 1023]
+inline double exp2(double x) {
+  x = x < -1022 ? -1022 : (x > 1023 ? 1023 : x);
+  // 2^x = 2^k * e^(f ln2) with k the nearest integer and |f| <= 1/2
+  auto shifted = x + round_magic;
+  auto k = shifted - round_magic;
+  auto f = (x - k) * ln2;
+  auto p = 1 + f * (1 + f * (1 / 2. + f * (1 / 6. + f * (1 / 24. +
+           f * (1 / 120. + f * (1 / 720. + f * (1 / 5040. +
+           f * (1 / 40320.))))))));
+  // the exponent field of 2^k
+  auto scale = from_bits((to_bits(shifted) + 1023) << 52);
+  return p * scale;
+}
+
+// absolute error < 3e-11, for normal x > 0
+inline double log2(double x) {
+  auto bits = to_bits(x);
+  auto exponent = double(int((bits >> 52) & 0x7ff) - 1023);
+  // mantissa in [1, 2), moved to [sqrt(1/2), sqrt(2))
+  auto m = from_bits((bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+  bool is_big = m > 1.41421356237309504880;
+  m = is_big ? m * 0.5 : m;
+  exponent = is_big ? exponent + 1 : exponent;
+  // log(m) = 2 atanh(s), |s| < 0.172
+  auto s = (m - 1) / (m + 1);
+  auto s2 = s * s;
+  auto series = s * (1 + s2 * (1 / 3. + s2 * (1 / 5. + s2 * (1 / 7. +
+                s2 * (1 / 9. + s2 * (1 / 11.))))));
+  return exponent + series * (2 / ln2);
+}
+
+// relative error < 3e-10 + 2e-11 |y|, for x >= 0
+inline double pow(double x, double y) {
+  return x > 0 ? exp2(y * log2(x)) : 0;
+}
+
+// absolute error < 1e-11 for |x| < 1e5
+inline void sincos(double x, double &s, double &c) {
+  // x = k pi/2 + r with |r| <= pi/4, pi/2 split in two so that r is exact
+  const double pi_2_high = 1.57079632673412561417;
+  const double pi_2_low = 6.07710050650619224932e-11;
+  auto shifted = x * (2 / pi) + round_magic;
+  auto k = shifted - round_magic;
+  auto quadrant = to_bits(shifted) & 3;
+  auto r = (x - k * pi_2_high) - k * pi_2_low;
+  auto r2 = r * r;
+  auto sin_r = r * (1 - r2 / 6. * (1 - r2 / 20. * (1 - r2 / 42. *
+               (1 - r2 / 72. * (1 - r2 / 110.)))));
+  auto cos_r = 1 - r2 / 2. * (1 - r2 / 12. * (1 - r2 / 30. * (1 - r2 / 56. *
+               (1 - r2 / 90. * (1 - r2 / 132.)))));
+  // sin(r + k pi/2) and cos(r + k pi/2) by the quadrant
+  s = quadrant & 1 ? cos_r : sin_r;
+  s = quadrant & 2 ? -s : s;
+  c = quadrant & 1 ? sin_r : cos_r;
+  c = (quadrant + 1) & 2 ? -c : c;
+}
+
+inline double sin(double x) {
+  double s, c;
+  sincos(x, s, c);
+  return s;
+}
+
+inline double cos(double x) {
+  double s, c;
+  sincos(x, s, c);
+  return c;
+}
+
+// absolute error < 1e-10
+inline double atan2(double y, double x) {
+  auto ax = std::fabs(x), ay = std::fabs(y);
+  auto high = ax > ay ? ax : ay;
+  auto low = ax > ay ? ay : ax;
+  auto a = low / (high > 0 ? high : 1);
+  // atan(a) = pi/4 + atan((a - 1) / (a + 1)), so that |t| <= tan(pi/8)
+  bool is_big = a > 0.41421356237309504880;
+  auto t = is_big ? (a - 1) / (a + 1) : a;
+  auto t2 = t * t;
+  auto r = t * (1 - t2 * (1 / 3. - t2 * (1 / 5. - t2 * (1 / 7. -
+           t2 * (1 / 9. - t2 * (1 / 11. - t2 * (1 / 13. - t2 * (1 / 15. -
+           t2 * (1 / 17. - t2 * (1 / 19. - t2 * (1 / 21.)))))))))));
+  r = is_big ? pi_4 + r : r;
+  r = ay > ax ? pi_2 - r : r;
+  r = x < 0 ? pi - r : r;
+  return std::signbit(y) ? -r : r;
+}
+
+// absolute error < 3e-8, for x in [-1, 1]
+// Abramowitz and Stegun, Handbook of Mathematical Functions, 4.4.46
+inline double acos(double x) {
+  auto a = std::fabs(x);
+  auto p = 1.5707963050 + a * (-0.2145988016 + a * (0.0889789874 +
+           a * (-0.0501743046 + a * (0.0308918810 + a * (-0.0170881256 +
+           a * (0.0066700901 + a * -0.0012624911))))));
+  auto r = std::sqrt(1 - a) * p;
+  return x < 0 ? pi - r : r;
+}
+
+} // namespace approx
+
+inline double fast_pow(double x, double y) {
+#ifdef FAST_MATH
+  return approx::pow(x, y);
+#else
+  return std::pow(x, y);
+#endif
+}
+
+inline void fast_sincos(double x, double &s, double &c) {
+#ifdef FAST_MATH
+  approx::sincos(x, s, c);
+#else
+  s = std::sin(x);
+  c = std::cos(x);
+#endif
+}
+
+inline double fast_atan2(double y, double x) {
+#ifdef FAST_MATH
+  return approx::atan2(y, x);
+#else
+  return std::atan2(y, x);
+#endif
+}
+
+inline double fast_acos(double x) {
+#ifdef FAST_MATH
+  return approx::acos(x);
+#else
+  return std::acos(x);
+#endif
+}
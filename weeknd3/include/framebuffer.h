@@ -0,0 +1,155 @@
+#pragma once
+#include "common.h"
+#include "stats.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// row-major image starting from the top-left pixel
+template <typename T> class Image {
+public:
+  Image() {}
+  Image(int _width, int _height, const T &value = T())
+      : width(_width), height(_height),
+        pixels(size_t(_width) * _height, value) {}
+
+  int get_width() const { return width; }
+  int get_height() const { return height; }
+
+  T &at(int i, int j) { return pixels[size_t(j) * width + i]; }
+  const T &at(int i, int j) const { return pixels[size_t(j) * width + i]; }
+
+  void swap(Image &other) {
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    pixels.swap(other.pixels);
+  }
+
+private:
+  int width = 0;
+  int height = 0;
+  std::vector<T> pixels;
+};
+
+// portable float map, the simplest lossless float image format
+// rows are stored from bottom to top, negative scale means little endian
+inline bool write_pfm(const std::string &filename, const Image<vec3> &image) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file)
+    return false;
+  const int width = image.get_width();
+  const int height = image.get_height();
+  file << "PF\n" << width << " " << height << "\n-1.0\n";
+  std::vector<float> row(size_t(width) * 3);
+  for (int j = height - 1; j >= 0; --j) {
+    for (int i = 0; i < width; ++i)
+      for (int c = 0; c < 3; ++c)
+        row[size_t(i) * 3 + c] = float(image.at(i, j)[c]);
+    file.write(reinterpret_cast<const char *>(row.data()),
+               row.size() * sizeof(float));
+  }
+  return bool(file);
+}
+
+inline bool write_pfm(const std::string &filename,
+                      const Image<double> &image) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file)
+    return false;
+  const int width = image.get_width();
+  const int height = image.get_height();
+  file << "Pf\n" << width << " " << height << "\n-1.0\n";
+  std::vector<float> row(width);
+  for (int j = height - 1; j >= 0; --j) {
+    for (int i = 0; i < width; ++i)
+      row[i] = float(image.at(i, j));
+    file.write(reinterpret_cast<const char *>(row.data()),
+               row.size() * sizeof(float));
+  }
+  return bool(file);
+}
+
+// color images written by write_pfm, false if the file is not one
+inline bool read_pfm(const std::string &filename, Image<vec3> &image) {
+  std::ifstream file(filename, std::ios::binary);
+  std::string magic;
+  int width, height;
+  double scale;
+  if (!(file >> magic >> width >> height >> scale) || magic != "PF" ||
+      width <= 0 || height <= 0 || scale >= 0)
+    return false;
+  // a single whitespace ends the header
+  file.get();
+  Image<vec3> result(width, height);
+  std::vector<float> row(size_t(width) * 3);
+  for (int j = height - 1; j >= 0; --j) {
+    if (!file.read(reinterpret_cast<char *>(row.data()),
+                   row.size() * sizeof(float)))
+      return false;
+    for (int i = 0; i < width; ++i)
+      for (int c = 0; c < 3; ++c)
+        result.at(i, j)[c] = row[size_t(i) * 3 + c];
+  }
+  image.swap(result);
+  return true;
+}
+
+// linear (not gamma-corrected) output of the renderer
+// besides the color, arbitrary output variables (aovs) are recorded at the
+// first hit of the camera rays
+// albedo, normal and depth are averaged over the samples of a pixel and guide
+// the denoiser, ids are taken from the first sample since they cannot be
+// averaged
+class FrameBuffer {
+public:
+  Image<color> beauty;
+  Image<color> albedo;
+  Image<vec3> normal;
+  // distance to the first hit, 0 if the camera ray escapes
+  Image<double> depth;
+  // 0 if nothing is hit
+  Image<double> material_id;
+  Image<double> object_id;
+  Image<double> sample_count;
+  // wall time spent on the pixel in milliseconds
+  Image<double> time;
+  // bvh nodes and primitive tests of the pixel's rays, only counted when
+  // built with RENDER_STATS
+  Image<double> steps;
+
+  FrameBuffer(int width, int height)
+      : beauty(width, height, color(0, 0, 0)),
+        albedo(width, height, color(0, 0, 0)),
+        normal(width, height, vec3(0, 0, 0)), depth(width, height, 0.),
+        material_id(width, height, 0.), object_id(width, height, 0.),
+        sample_count(width, height, 0.), time(width, height, 0.),
+        steps(width, height, 0.) {}
+
+  int get_width() const { return beauty.get_width(); }
+  int get_height() const { return beauty.get_height(); }
+
+  // one float image per aov: <prefix>_color.pfm, <prefix>_albedo.pfm, ...
+  bool write_aovs(const std::string &prefix) const {
+    bool ok = write_pfm(prefix + "_color.pfm", beauty);
+    ok &= write_pfm(prefix + "_albedo.pfm", albedo);
+    ok &= write_pfm(prefix + "_normal.pfm", normal);
+    ok &= write_pfm(prefix + "_depth.pfm", depth);
+    ok &= write_pfm(prefix + "_material_id.pfm", material_id);
+    ok &= write_pfm(prefix + "_object_id.pfm", object_id);
+    ok &= write_pfm(prefix + "_sample_count.pfm", sample_count);
+    ok &= write_pfm(prefix + "_time.pfm", time);
+    if (RenderStats::enabled)
+      ok &= write_pfm(prefix + "_steps.pfm", steps);
+    return ok;
+  }
+};
+
+// first-hit information of one camera ray
+struct AOVSample {
+  color albedo = color(1, 1, 1);
+  vec3 normal = vec3(0, 0, 0);
+  double depth = 0;
+  int material_id = 0;
+  int object_id = 0;
+};
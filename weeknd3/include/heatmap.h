@@ -0,0 +1,118 @@
+#pragma once
+#include "framebuffer.h"
+#include <algorithm>
+#include <map>
+
+// false-color images of the per-pixel cost, to see where the render time goes
+// (glass, smoke, deep bvhs) and which objects it is spent on
+
+// what a pixel's cost is measured in
+enum class CostMetric {
+  // wall time of the pixel, FrameBuffer::time
+  Time,
+  // bvh nodes and primitive tests of its rays, FrameBuffer::steps, only
+  // counted when built with RENDER_STATS
+  Steps
+};
+
+inline const Image<double> &get_cost(const FrameBuffer &fb,
+                                     CostMetric metric) {
+  return metric == CostMetric::Time ? fb.time : fb.steps;
+}
+
+inline const char *get_cost_unit(CostMetric metric) {
+  return metric == CostMetric::Time ? "ms" : "steps";
+}
+
+// the inferno color map sampled at 9 stops, x in [0, 1]
+inline color cost_color(double x) {
+  static const color stops[] = {
+      color(0.001, 0.000, 0.014), color(0.106, 0.047, 0.255),
+      color(0.290, 0.047, 0.420), color(0.471, 0.110, 0.427),
+      color(0.647, 0.173, 0.376), color(0.812, 0.267, 0.275),
+      color(0.929, 0.412, 0.145), color(0.984, 0.608, 0.024),
+      color(0.988, 1.000, 0.643)};
+  const int last = int(sizeof(stops) / sizeof(stops[0])) - 1;
+  auto scaled = std::min(std::max(x, 0.), 1.) * last;
+  auto index = std::min(int(scaled), last - 1);
+  auto f = scaled - index;
+  return stops[index] * (1 - f) + stops[index + 1] * f;
+}
+
+// value of the given percentile, so that a few outliers do not make every
+// other pixel black
+inline double cost_percentile(const Image<double> &cost, double percentile) {
+  std::vector<double> values;
+  values.reserve(size_t(cost.get_width()) * cost.get_height());
+  for (int j = 0; j < cost.get_height(); ++j)
+    for (int i = 0; i < cost.get_width(); ++i)
+      values.push_back(cost.at(i, j));
+  if (values.empty())
+    return 0;
+  auto rank = size_t(percentile * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + rank, values.end());
+  return values[rank];
+}
+
+// ppm from black at 0 to pale yellow at the 99th percentile and above, the
+// color map is already gamma encoded so it is written as bytes directly
+inline bool write_heatmap(const std::string &filename,
+                          const Image<double> &cost, double &max_cost) {
+  std::ofstream file(filename);
+  if (!file)
+    return false;
+  max_cost = cost_percentile(cost, 0.99);
+  const auto scale = max_cost > 0 ? 1 / max_cost : 0.;
+  file << "P3\n" << cost.get_width() << " " << cost.get_height() << "\n255\n";
+  for (int j = 0; j < cost.get_height(); ++j) {
+    for (int i = 0; i < cost.get_width(); ++i) {
+      auto c = cost_color(cost.at(i, j) * scale);
+      file << int(255 * c.r) << ' ' << int(255 * c.g) << ' ' << int(255 * c.b)
+           << '\n';
+    }
+  }
+  return bool(file);
+}
+
+// the objects whose pixels cost the most, by the object hit first in the
+// pixel (the object_id aov), 0 is the background
+inline void report_cost_by_object(std::ostream &output, const FrameBuffer &fb,
+                                  CostMetric metric, const size_t count = 5) {
+  struct ObjectCost {
+    int id = 0;
+    double cost = 0;
+    int pixels = 0;
+  };
+  const auto &cost = get_cost(fb, metric);
+  std::map<int, ObjectCost> objects;
+  double total = 0;
+  for (int j = 0; j < fb.get_height(); ++j) {
+    for (int i = 0; i < fb.get_width(); ++i) {
+      auto id = int(fb.object_id.at(i, j));
+      auto &object = objects[id];
+      object.id = id;
+      object.cost += cost.at(i, j);
+      ++object.pixels;
+      total += cost.at(i, j);
+    }
+  }
+  if (total <= 0)
+    return;
+
+  std::vector<ObjectCost> sorted;
+  for (const auto &object : objects)
+    sorted.push_back(object.second);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const ObjectCost &a, const ObjectCost &b) {
+              return a.cost > b.cost;
+            });
+  const double pixels = double(fb.get_width()) * fb.get_height();
+  output << "cost by object:\n";
+  for (size_t k = 0; k < std::min(count, sorted.size()); ++k) {
+    output << "  object " << sorted[k].id << ": "
+           << 100 * sorted[k].cost / total << "% of the "
+           << get_cost_unit(metric) << " in " << 100 * sorted[k].pixels / pixels
+           << "% of the pixels\n";
+  }
+  output << std::flush;
+}
@@ -1,11 +1,15 @@
 #pragma once
 #include "aabb.h"
+#include "affine.h"
 #include "common.h"
 #include "ray.h"
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 using std::vector;
 class Material;
+class Hittable;
 
 // in fact this class is better to be treated as a struct
 // better to set all the members public
@@ -21,6 +25,17 @@ public:
   // in graphics pipeline this should be stored within the model
   double u, v;
   std::shared_ptr<Material> mat;
+  // id of the primitive that was hit, for aov output
+  int object_id = 0;
+  // while searching for the closest hit, a primitive only stores t, itself
+  // and what it needs to complete the record (e.g. barycentrics in u & v, a
+  // triangle in primitive), null once the record is complete
+  const Hittable *object = nullptr;
+  uint32_t primitive = 0;
+
+  // fills the rest of the record, r is the ray the hit was found with
+  void finalize(const Ray &r);
+
   void set(const vec3 &_p, const vec3 &_normal, const double _t) {
     p = _p;
     normal = _normal;
@@ -50,12 +65,66 @@ public:
   }
 };
 
+// closest hits of a ray packet
+// t_max[lane] shrinks as closer hits are found, like closet_so_far in
+// HittableList::hit
+class PacketHit {
+public:
+  HitRecord rec[RayPacket::size];
+  double t_max[RayPacket::size];
+  bool is_hit[RayPacket::size];
+  // the random stream of each lane, media draw from it while it is
+  // intersected, the same as for a single ray keyed like this lane
+  RandomStream random[RayPacket::size];
+
+  PacketHit() {
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      t_max[lane] = infinity;
+      is_hit[lane] = false;
+    }
+  }
+};
+
+// ids start from 1, 0 stands for nothing
+inline int next_object_id() {
+  static std::atomic<int> counter(0);
+  return ++counter;
+}
+
 class Hittable {
 public:
+  Hittable() : id(next_object_id()) {}
   virtual ~Hittable() = default;
 
+  int get_id() const { return id; }
+
   virtual bool hit(const Ray &r, const Interval &ray_t,
                    HitRecord &rec) const = 0;
+
+  // completes a record that hit() left to this object, so that normals, uv
+  // and the material are only computed for the closest hit
+  virtual void finalize(const Ray &r, HitRecord &rec) const {}
+
+  // intersect all active lanes of a packet within [t_min, hits.t_max[lane]]
+  // the default traces the lanes one by one, primitives and the bvh override
+  // it with per-lane loops
+  // hit() may draw random numbers (media), so each lane runs on its own
+  // stream, overrides must not draw any
+  virtual void hit_packet(const RayPacket &packet, double t_min,
+                          PacketHit &hits) const {
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      if (!packet.active[lane])
+        continue;
+      thread_random() = hits.random[lane];
+      if (hit(packet.ray(lane), Interval(t_min, hits.t_max[lane]),
+              hits.rec[lane])) {
+        hits.t_max[lane] = hits.rec[lane].t;
+        hits.is_hit[lane] = true;
+      }
+      hits.random[lane] = thread_random();
+    }
+  }
+
   virtual double pdf_value(const vec3 &origin, const vec3 &direction) const {
     return 0.0;
   }
@@ -64,11 +133,37 @@ public:
 
   virtual vec3 random(const vec3 &origin) const { return vec3(1, 0, 0); }
 
+  // same as above, but driven by a sample of the unit square
+  virtual vec3 random(const vec3 &origin, const vec2 &sample) const {
+    return random(origin);
+  }
+
   virtual AABB get_bbox() const = 0;
+
+  // bounds at shutter open (time 0) and close (time 1). for objects moving
+  // linearly their interpolation bounds the object at any time in between,
+  // which is much tighter than get_bbox() for fast motion
+  virtual AABB get_bbox_begin() const { return get_bbox(); }
+  virtual AABB get_bbox_end() const { return get_bbox(); }
+
+  // rough cost of hit() relative to a box test, decides how many objects
+  // share a bvh leaf
+  virtual double intersection_cost() const { return 1; }
+
+protected:
+  int id;
 };
 
+inline void HitRecord::finalize(const Ray &r) {
+  if (!object)
+    return;
+  auto deferred = object;
+  object = nullptr;
+  deferred->finalize(r, *this);
+}
+
 class HittableList : public Hittable {
-  AABB bbox;
+  AABB bbox, bbox_begin, bbox_end;
 
 public:
   vector<shared_ptr<Hittable>> objects;
@@ -82,6 +177,8 @@ public:
   void add(shared_ptr<Hittable> object) {
     objects.emplace_back(object);
     bbox = AABB(bbox, object->get_bbox());
+    bbox_begin = AABB(bbox_begin, object->get_bbox_begin());
+    bbox_end = AABB(bbox_end, object->get_bbox_end());
   }
 
   void debugp() const override {
@@ -105,6 +202,14 @@ public:
     return objects[random_int(0, int_size - 1)]->random(origin);
   }
 
+  vec3 random(const vec3 &origin, const vec2 &sample) const override {
+    // pick an object with the first component and reuse what is left of it
+    auto int_size = int(objects.size());
+    auto scaled = sample.x * int_size;
+    auto index = std::min(int(scaled), int_size - 1);
+    return objects[index]->random(origin, vec2(scaled - index, sample.y));
+  }
+
   virtual bool hit(const Ray &r, const Interval &ray_t,
                    HitRecord &rec) const override {
     HitRecord tmp_rec;
@@ -122,112 +227,124 @@ public:
     return hit;
   }
 
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    for (const auto &object : objects)
+      object->hit_packet(packet, t_min, hits);
+  }
+
   virtual AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
+
+  double intersection_cost() const override {
+    double cost = 0;
+    for (const auto &object : objects)
+      cost += object->intersection_cost();
+    return cost;
+  }
 };
 
-// reversely moving the ray instead of moveing the object
-// but need to recalculate for every ray
-class Translate : public Hittable {
+// affine transform of an object, the ray is moved into object space instead
+// of moving the object
+// the matrices are computed once, so nested transforms should be multiplied
+// into one Transform rather than wrapped in each other
+class Transform : public Hittable {
 public:
-  Translate(shared_ptr<Hittable> _object, const vec3 &_offset)
-      : object(_object), offset(_offset) {
-    bbox = object->get_bbox() + offset;
+  Transform(shared_ptr<Hittable> _object, const Affine &_object_to_world)
+      : object(_object), object_to_world(_object_to_world),
+        world_to_object(_object_to_world.inverse()),
+        normal_matrix(world_to_object.transposed_linear()) {
+    bbox = object_to_world.transform_box(object->get_bbox());
+    // exact, transform_box is linear in the box center and extent
+    bbox_begin = object_to_world.transform_box(object->get_bbox_begin());
+    bbox_end = object_to_world.transform_box(object->get_bbox_end());
   }
 
-  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
-    // Move the ray backwards by the offset
-    Ray offset_r(r.origin() - offset, r.direction(), r.time());
+  const Affine &get_matrix() const { return object_to_world; }
 
-    // Determine whether an intersection exists along the offset ray (and if so,
-    // where)
-    if (!object->hit(offset_r, ray_t, rec))
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    RENDER_STAT(transform_tests);
+    Ray object_r(world_to_object.transform_point(r.origin()),
+                 world_to_object.transform_vector(r.direction()), r.time());
+    if (!object->hit(object_r, ray_t, rec))
       return false;
 
-    // Move the intersection point forwards by the offset
-    rec.p = rec.p + offset;
-
+    // the normal is only known in object space, so the record is completed
+    // here rather than after the whole search
+    rec.finalize(object_r);
+    // t is the same in both spaces, and so is the sign of dot(direction,
+    // normal) that decided the front face
+    rec.p = object_to_world.transform_point(rec.p);
+    rec.normal = glm::normalize(normal_matrix.transform_vector(rec.normal));
     return true;
   }
-  AABB get_bbox() const override { return bbox; }
-
-private:
-  shared_ptr<Hittable> object;
-  vec3 offset;
-  AABB bbox;
-};
 
-// reversely moving the ray instead of moveing the object
-// but need to recalculate for every ray
-class RotateY : public Hittable {
-public:
-  RotateY(shared_ptr<Hittable> object, double angle) : object(object) {
-    auto radians = degrees2radians(angle);
-    sin_theta = std::sin(radians);
-    cos_theta = std::cos(radians);
-    bbox = object->get_bbox();
-
-    vec3 min(infinity, infinity, infinity);
-    vec3 max(-infinity, -infinity, -infinity);
-
-    for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 2; j++) {
-        for (int k = 0; k < 2; k++) {
-          auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-          auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-          auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-          auto newx = cos_theta * x + sin_theta * z;
-          auto newz = -sin_theta * x + cos_theta * z;
-
-          vec3 tester(newx, y, newz);
-
-          for (int c = 0; c < 3; c++) {
-            min[c] = std::fmin(min[c], tester[c]);
-            max[c] = std::fmax(max[c], tester[c]);
-          }
-        }
-      }
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    RENDER_STAT_ADD(transform_tests, packet.active_count());
+    RayPacket object_packet = packet;
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      auto o = world_to_object.transform_point(
+          vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]));
+      auto d = world_to_object.transform_vector(
+          vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]));
+      object_packet.ox[lane] = o.x;
+      object_packet.oy[lane] = o.y;
+      object_packet.oz[lane] = o.z;
+      object_packet.dx[lane] = d.x;
+      object_packet.dy[lane] = d.y;
+      object_packet.dz[lane] = d.z;
+      object_packet.update_inverse(lane);
     }
 
-    bbox = AABB(min, max);
+    double t_before[RayPacket::size];
+    std::copy(hits.t_max, hits.t_max + RayPacket::size, t_before);
+    object->hit_packet(object_packet, t_min, hits);
+
+    // only the lanes with a new closest hit come from this object
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      if (hits.t_max[lane] == t_before[lane])
+        continue;
+      auto &rec = hits.rec[lane];
+      rec.finalize(object_packet.ray(lane));
+      rec.p = object_to_world.transform_point(rec.p);
+      rec.normal = glm::normalize(normal_matrix.transform_vector(rec.normal));
+    }
   }
 
-  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
-
-    // Transform the ray from world space to object space.
-
-    auto origin = vec3((cos_theta * r.origin().x) - (sin_theta * r.origin().z),
-                       r.origin().y,
-                       (sin_theta * r.origin().x) + (cos_theta * r.origin().z));
-
-    auto direction =
-        vec3((cos_theta * r.direction().x) - (sin_theta * r.direction().z),
-             r.direction().y,
-             (sin_theta * r.direction().x) + (cos_theta * r.direction().z));
-
-    Ray rotated_r(origin, direction, r.time());
-
-    // Determine whether an intersection exists in object space (and if so,
-    // where).
-    if (!object->hit(rotated_r, ray_t, rec))
-      return false;
+  AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
 
-    // Transform the intersection from object space back to world space.
-    rec.p = vec3((cos_theta * rec.p.x) + (sin_theta * rec.p.z), rec.p.y,
-                 (-sin_theta * rec.p.x) + (cos_theta * rec.p.z));
+  // moving the ray costs about one box test
+  double intersection_cost() const override {
+    return 1 + object->intersection_cost();
+  }
 
-    rec.normal = vec3((cos_theta * rec.normal.x) + (sin_theta * rec.normal.z),
-                      rec.normal.y,
-                      (-sin_theta * rec.normal.x) + (cos_theta * rec.normal.z));
+  // light sampling in object space, only correct for transforms that keep
+  // angles (Affine::is_similarity)
+  double pdf_value(const vec3 &origin, const vec3 &direction) const override {
+    return object->pdf_value(world_to_object.transform_point(origin),
+                             world_to_object.transform_vector(direction));
+  }
 
-    return true;
+  vec3 random(const vec3 &origin) const override {
+    return object_to_world.transform_vector(
+        object->random(world_to_object.transform_point(origin)));
   }
 
-  AABB get_bbox() const override { return bbox; }
+  vec3 random(const vec3 &origin, const vec2 &sample) const override {
+    return object_to_world.transform_vector(
+        object->random(world_to_object.transform_point(origin), sample));
+  }
 
 private:
   shared_ptr<Hittable> object;
-  double sin_theta;
-  double cos_theta;
-  AABB bbox;
-};
\ No newline at end of file
+  Affine object_to_world;
+  Affine world_to_object;
+  // inverse transpose of the linear part, keeps normals perpendicular under
+  // non-uniform scaling
+  Affine normal_matrix;
+  AABB bbox, bbox_begin, bbox_end;
+};
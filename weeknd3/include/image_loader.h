@@ -9,6 +9,7 @@
 #define STBI_FAILURE_USERMSG
 #include "stb/stb_image.h"
 
+#include "trace.h"
 #include <cstdlib>
 #include <iostream>
 
@@ -53,6 +54,7 @@ class ImageLoader {
         // contiguous, going left to right for the width of the image, followed by the next row
         // below, for the full height of the image.
 
+        TraceSpan span("load image");
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
         fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
         if (fdata == nullptr) return false;
@@ -0,0 +1,194 @@
+#pragma once
+#include "affine.h"
+#include "hittable.h"
+#include "trace.h"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// a shared object placed in the world with an affine transform
+// only the world to object transform is kept: t does not change when the ray
+// is transformed, so the world hit point is r.at(t), and normals only need
+// the transposed linear part of the inverse
+class Instance {
+public:
+  Instance(shared_ptr<Hittable> _object, const Affine &object_to_world)
+      : object(_object), world_to_object(object_to_world.inverse()),
+        bbox(object_to_world.transform_box(_object->get_bbox())),
+        bbox_begin(object_to_world.transform_box(_object->get_bbox_begin())),
+        bbox_end(object_to_world.transform_box(_object->get_bbox_end())) {}
+
+  const AABB &get_bbox() const { return bbox; }
+  const AABB &get_bbox_begin() const { return bbox_begin; }
+  const AABB &get_bbox_end() const { return bbox_end; }
+
+  // moving the ray costs about one box test, like Transform
+  double intersection_cost() const { return 1 + object->intersection_cost(); }
+
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const {
+    RENDER_STAT(transform_tests);
+    return object->hit(object_ray(r), ray_t, rec);
+  }
+
+  // completes a record hit() has left in object space
+  void finalize(const Ray &r, HitRecord &rec) const {
+    rec.finalize(object_ray(r));
+    // front_face stays valid: dot(direction, normal) is preserved
+    rec.p = r.at(rec.t);
+    rec.normal =
+        glm::normalize(world_to_object.transform_normal_transposed(rec.normal));
+  }
+
+private:
+  shared_ptr<Hittable> object;
+  Affine world_to_object;
+  AABB bbox, bbox_begin, bbox_end;
+
+  Ray object_ray(const Ray &r) const {
+    return Ray(world_to_object.transform_point(r.origin()),
+               world_to_object.transform_vector(r.direction()), r.time());
+  }
+};
+
+// top level of a two-level hierarchy: a bvh over instances whose objects
+// (usually bvhs themselves) are shared, so repeating geometry costs one
+// Instance, not a copy of the geometry or a chain of wrappers
+// instances are stored by value in the order of the bvh leaves
+class InstanceBVH : public Hittable {
+public:
+  InstanceBVH() {}
+
+  void add(shared_ptr<Hittable> object, const Affine &object_to_world) {
+    instances.emplace_back(object, object_to_world);
+    bbox = AABB(bbox, instances.back().get_bbox());
+    bbox_begin = AABB(bbox_begin, instances.back().get_bbox_begin());
+    bbox_end = AABB(bbox_end, instances.back().get_bbox_end());
+  }
+
+  size_t size() const { return instances.size(); }
+
+  // call after the last add()
+  void build() {
+    TraceSpan span("build instance bvh", "instances",
+                   (long long)instances.size());
+    nodes.clear();
+    if (instances.empty())
+      return;
+    nodes.reserve(2 * instances.size());
+    build_node(0, instances.size(), 0);
+    update_cost();
+  }
+
+  void debugp() const override {
+    std::clog << "instances(" << instances.size() << ")" << std::flush;
+  }
+
+  AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
+  double intersection_cost() const override { return cost; }
+
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    if (nodes.empty())
+      return false;
+
+    // the record of the closest instance is completed once at the end
+    uint32_t hit_instance = UINT32_MAX;
+    auto closest = ray_t.max;
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      const auto &node = nodes[current];
+      RENDER_STAT(bvh_nodes);
+      if (node.bbox.hit(r, Interval(ray_t.min, closest))) {
+        if (node.count > 0) {
+          for (auto k = node.offset; k < node.offset + node.count; ++k) {
+            if (instances[k].hit(r, Interval(ray_t.min, closest), rec)) {
+              hit_instance = k;
+              closest = rec.t;
+            }
+          }
+        } else {
+          assert(stack_size < max_depth);
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+    if (hit_instance == UINT32_MAX)
+      return false;
+    instances[hit_instance].finalize(r, rec);
+    return true;
+  }
+
+private:
+  // left child is the next node, right child at offset for interior nodes;
+  // leaves cover instances[offset, offset + count)
+  struct Node {
+    AABB bbox;
+    uint32_t offset;
+    uint32_t count;
+  };
+
+  static const size_t max_leaf_size = 2;
+  // levels below the root, traversal keeps at most one node per level on
+  // its stack. median splits stop at 33 levels for 2^32 instances, the
+  // limit only guards the stack
+  static const int max_depth = 60;
+  static constexpr double traversal_cost = 1;
+
+  std::vector<Instance> instances;
+  std::vector<Node> nodes;
+  AABB bbox, bbox_begin, bbox_end;
+  // surface area heuristic of the tree, like BVHNode::sah_cost
+  double cost = 0;
+
+  void update_cost() {
+    cost = 0;
+    auto area = bbox.surface_area();
+    if (nodes.empty() || area <= 0)
+      return;
+    for (const auto &node : nodes) {
+      auto node_cost = traversal_cost;
+      for (auto k = node.offset; k < node.offset + node.count; ++k)
+        node_cost += instances[k].intersection_cost();
+      cost += node.bbox.surface_area() * node_cost;
+    }
+    cost /= area;
+  }
+
+  // object median split on the longest axis, like BVHNode
+  void build_node(size_t start, size_t end, int depth) {
+    const auto index = nodes.size();
+    nodes.push_back(Node{AABB::get_empty(), uint32_t(start), 0});
+    auto bounds = AABB::get_empty();
+    for (auto k = start; k < end; ++k)
+      bounds = AABB(bounds, instances[k].get_bbox());
+    nodes[index].bbox = bounds;
+
+    if (end - start <= max_leaf_size || depth >= max_depth) {
+      nodes[index].count = uint32_t(end - start);
+      return;
+    }
+
+    const int axis = bounds.longest_axis();
+    auto center = [axis](const Instance &instance) {
+      const auto &interval = instance.get_bbox().axis_interval(axis);
+      return interval.min + interval.max;
+    };
+    const auto mid = start + (end - start) / 2;
+    std::nth_element(instances.begin() + start, instances.begin() + mid,
+                     instances.begin() + end,
+                     [&](const Instance &a, const Instance &b) {
+                       return center(a) < center(b);
+                     });
+    build_node(start, mid, depth + 1);
+    nodes[index].offset = uint32_t(nodes.size());
+    build_node(mid, end, depth + 1);
+  }
+};
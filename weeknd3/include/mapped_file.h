@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read-only memory mapping of a whole file
+// parsers work on the mapped bytes directly instead of copying them through
+// a stream, and the pages are shared with the os file cache
+class MappedFile {
+public:
+  MappedFile() {}
+
+  MappedFile(const std::string &filename, int advice = MADV_SEQUENTIAL) {
+    open(filename, advice);
+  }
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // advice tells the kernel how the pages will be read, see madvise(2)
+  bool open(const std::string &filename, int advice = MADV_SEQUENTIAL) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *mapped =
+        mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+    madvise(mapped, size_t(st.st_size), advice);
+    bytes = static_cast<const char *>(mapped);
+    length = size_t(st.st_size);
+    return true;
+  }
+
+  void close() {
+    if (bytes)
+      munmap(const_cast<char *>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+  }
+
+  bool is_open() const { return bytes != nullptr; }
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+  const char *begin() const { return bytes; }
+  const char *end() const { return bytes + length; }
+
+private:
+  const char *bytes = nullptr;
+  size_t length = 0;
+};
@@ -14,10 +14,18 @@ public:
   Ray skip_pdf_ray;
 };
 
+inline int next_material_id() {
+  static std::atomic<int> counter(0);
+  return ++counter;
+}
+
 class Material {
 public:
+  Material() : id(next_material_id()) {}
   virtual ~Material() = default;
 
+  int get_id() const { return id; }
+
   virtual bool scatter(const Ray &r_in, const HitRecord &rec,
                        ISRecord &srec) const {
     return false;
@@ -35,6 +43,9 @@ public:
                         double v, const vec3 &p) const {
     return color(0, 0, 0);
   }
+
+protected:
+  int id;
 };
 
 class Lambertian : public Material {
@@ -45,7 +56,7 @@ public:
   bool scatter(const Ray &r_in, const HitRecord &rec,
                ISRecord &srec) const override {
     srec.attenuation = tex->get_value(rec.u, rec.v, rec.p);
-    srec.pdf_ptr = make_shared<CosinePDF>(rec.normal);
+    srec.pdf_ptr = make_pdf<CosinePDF>(rec.normal);
     srec.is_direction_determined = false;
     return true;
 
@@ -125,7 +136,7 @@ private:
     // Use Schlick's approximation for reflectance.
     auto r0 = (1 - refraction_index) / (1 + refraction_index);
     r0 = r0 * r0;
-    return r0 + (1 - r0) * std::pow((1 - cosine), 5);
+    return r0 + (1 - r0) * fast_pow((1 - cosine), 5);
   }
 };
 
@@ -155,7 +166,7 @@ public:
                ISRecord &srec) const override {
     // random scatter direction rather than calculation based on normal here
     srec.attenuation = tex->get_value(rec.u, rec.v, rec.p);
-    srec.pdf_ptr = make_shared<SpherePDF>();
+    srec.pdf_ptr = make_pdf<SpherePDF>();
     srec.is_direction_determined = false;
     return true;
   }
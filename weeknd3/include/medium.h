@@ -16,6 +16,7 @@ public:
         phase_function(make_shared<Isotropic>(albedo)) {}
 
   bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    RENDER_STAT(medium_tests);
     HitRecord rec1, rec2;
 
     // check if the ray goes through the medium
@@ -51,14 +52,23 @@ public:
       return false;
 
     // normal is casual
-    rec.set(r.at(rec.t), vec3(1, 0, 0), rec1.t + hit_distance / ray_length);
+    auto t = rec1.t + hit_distance / ray_length;
+    rec.set(r.at(t), vec3(1, 0, 0), t);
     rec.is_front_face = true; // also arbitrary
     rec.mat = phase_function;
+    rec.object_id = id;
+    // complete already
+    rec.object = nullptr;
 
     return true;
   }
 
   AABB get_bbox() const override { return boundary->get_bbox(); }
+  AABB get_bbox_begin() const override { return boundary->get_bbox_begin(); }
+  AABB get_bbox_end() const override { return boundary->get_bbox_end(); }
+  double intersection_cost() const override {
+    return 2 * boundary->intersection_cost();
+  }
 
 private:
   shared_ptr<Hittable> boundary;
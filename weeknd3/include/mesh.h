@@ -0,0 +1,479 @@
+#pragma once
+#include "buffer.h"
+#include "hittable.h"
+#include "trace.h"
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// vertex attributes are kept in single precision, meshes can be large
+using fvec3 = glm::vec3;
+using fvec2 = glm::vec2;
+
+// flattened bvh node over triangle indices, 32 bytes
+// an interior node's left child is the next node and its right child is at
+// offset, a leaf covers tri_order[offset, offset + count)
+struct MeshBVHNode {
+  float bmin[3];
+  float bmax[3];
+  uint32_t offset;
+  uint16_t count;
+  uint16_t axis;
+
+  bool is_leaf() const { return count > 0; }
+
+  // levels below the root, traversal keeps at most one node per level on
+  // its stack
+  static const int max_depth = 60;
+};
+
+// indexed triangle mesh data, one array per attribute
+// normals and uvs are optional: either empty or one per position
+// the bvh over the triangles is built once and lives here too, so it is
+// shared by every TriangleMesh using this data (e.g. with different
+// materials) and can be written to the mesh cache
+class MeshData {
+public:
+  Buffer<fvec3> positions;
+  Buffer<fvec3> normals;
+  Buffer<fvec2> uvs;
+  // 3 per triangle, counter-clockwise seen from the front
+  Buffer<uint32_t> indices;
+
+  Buffer<MeshBVHNode> nodes;
+  // triangle indices in the order of the bvh leaves
+  Buffer<uint32_t> tri_order;
+
+  size_t triangle_count() const { return indices.size() / 3; }
+  bool has_normals() const { return !normals.empty(); }
+  bool has_uvs() const { return !uvs.empty(); }
+  bool has_bvh() const { return !nodes.empty() || indices.empty(); }
+
+  // binned surface area heuristic, top-down
+  void build_bvh();
+
+  // expected node visits plus triangle tests of a ray hitting the root box,
+  // like BVHNode::sah_cost
+  double sah_cost() const {
+    if (nodes.empty())
+      return 0;
+    auto area = [](const MeshBVHNode &node) {
+      auto dx = double(node.bmax[0]) - node.bmin[0];
+      auto dy = double(node.bmax[1]) - node.bmin[1];
+      auto dz = double(node.bmax[2]) - node.bmin[2];
+      return 2 * (dx * dy + dy * dz + dz * dx);
+    };
+    auto root_area = area(nodes[0]);
+    if (!(root_area > 0))
+      return double(triangle_count());
+    double cost = 0;
+    for (const auto &node : nodes)
+      cost += area(node) * (1 + node.count);
+    return cost / root_area;
+  }
+
+  size_t memory_usage() const {
+    return positions.size() * sizeof(fvec3) + normals.size() * sizeof(fvec3) +
+           uvs.size() * sizeof(fvec2) + indices.size() * sizeof(uint32_t) +
+           tri_order.size() * sizeof(uint32_t) +
+           nodes.size() * sizeof(MeshBVHNode);
+  }
+};
+
+class TriangleMesh : public Hittable {
+public:
+  TriangleMesh(shared_ptr<MeshData> _data, shared_ptr<Material> _mat)
+      : data(_data), mat(_mat) {
+    if (!data->has_bvh())
+      data->build_bvh();
+    if (data->nodes.empty()) {
+      bbox = AABB::get_empty();
+      return;
+    }
+    const auto &root = data->nodes[0];
+    // the interval constructor pads flat meshes
+    bbox = AABB(Interval(root.bmin[0], root.bmax[0]),
+                Interval(root.bmin[1], root.bmax[1]),
+                Interval(root.bmin[2], root.bmax[2]));
+    cost = 1 + data->sah_cost();
+  }
+
+  void debugp() const override {
+    std::clog << "mesh(" << data->triangle_count() << ")" << std::flush;
+  }
+
+  AABB get_bbox() const override { return bbox; }
+
+  // one box test to enter the mesh, then its own bvh
+  double intersection_cost() const override { return cost; }
+
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    const auto &nodes = data->nodes;
+    const auto &tri_order = data->tri_order;
+    if (nodes.empty())
+      return false;
+
+    const WatertightRay wr(r);
+    const vec3 inv_dir(1. / r.direction().x, 1. / r.direction().y,
+                       1. / r.direction().z);
+    const int dir_negative[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+
+    // only the closest triangle is remembered during traversal, the hit
+    // record is filled by finalize()
+    double closest = ray_t.max;
+    uint32_t hit_triangle = UINT32_MAX;
+    double hit_b1 = 0, hit_b2 = 0;
+
+    uint32_t stack[MeshBVHNode::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    while (true) {
+      const auto &node = nodes[current];
+      RENDER_STAT(bvh_nodes);
+      if (node_hit(node, r.origin(), inv_dir, ray_t.min, closest)) {
+        if (node.is_leaf()) {
+          for (uint32_t k = node.offset; k < node.offset + node.count; ++k) {
+            double t, b1, b2;
+            if (intersect_triangle(wr, tri_order[k], ray_t.min, closest, t,
+                                   b1, b2)) {
+              closest = t;
+              hit_triangle = tri_order[k];
+              hit_b1 = b1;
+              hit_b2 = b2;
+            }
+          }
+        } else {
+          // visit the child on the near side first
+          assert(stack_size < MeshBVHNode::max_depth);
+          if (dir_negative[node.axis]) {
+            stack[stack_size++] = current + 1;
+            current = node.offset;
+          } else {
+            stack[stack_size++] = node.offset;
+            current = current + 1;
+          }
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+
+    if (hit_triangle == UINT32_MAX)
+      return false;
+    rec.t = closest;
+    rec.object = this;
+    rec.primitive = hit_triangle;
+    rec.u = hit_b1;
+    rec.v = hit_b2;
+    return true;
+  }
+
+  void finalize(const Ray &r, HitRecord &rec) const override {
+    fill_record(r, rec.t, rec.primitive, rec.u, rec.v, rec);
+  }
+
+private:
+  shared_ptr<MeshData> data;
+  shared_ptr<Material> mat;
+  AABB bbox;
+  double cost = 1;
+
+  // per-ray constants of the watertight test
+  // Woop, Benthin and Wald, Watertight Ray/Triangle Intersection, JCGT 2013
+  struct WatertightRay {
+    vec3 origin;
+    int kx, ky, kz;
+    double sx, sy, sz;
+
+    WatertightRay(const Ray &r) : origin(r.origin()) {
+      const auto &d = r.direction();
+      auto ad = vec3(std::fabs(d.x), std::fabs(d.y), std::fabs(d.z));
+      kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+      kx = (kz + 1) % 3;
+      ky = (kx + 1) % 3;
+      // keep the winding direction
+      if (d[kz] < 0)
+        std::swap(kx, ky);
+      sx = d[kx] / d[kz];
+      sy = d[ky] / d[kz];
+      sz = 1. / d[kz];
+    }
+  };
+
+  bool intersect_triangle(const WatertightRay &wr, uint32_t triangle,
+                          double t_min, double t_max, double &t, double &b1,
+                          double &b2) const {
+    RENDER_STAT(triangle_tests);
+    const auto *index = &data->indices[size_t(triangle) * 3];
+    const vec3 a = vec3(data->positions[index[0]]) - wr.origin;
+    const vec3 b = vec3(data->positions[index[1]]) - wr.origin;
+    const vec3 c = vec3(data->positions[index[2]]) - wr.origin;
+
+    // shear and scale so that the ray goes along +z
+    const double ax = a[wr.kx] - wr.sx * a[wr.kz];
+    const double ay = a[wr.ky] - wr.sy * a[wr.kz];
+    const double bx = b[wr.kx] - wr.sx * b[wr.kz];
+    const double by = b[wr.ky] - wr.sy * b[wr.kz];
+    const double cx = c[wr.kx] - wr.sx * c[wr.kz];
+    const double cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+    // scaled barycentrics, edges are shared exactly by neighbours
+    const double u = cx * by - cy * bx;
+    const double v = ax * cy - ay * cx;
+    const double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+      return false;
+    const double det = u + v + w;
+    if (det == 0)
+      return false;
+
+    const double scaled_t =
+        wr.sz * (u * a[wr.kz] + v * b[wr.kz] + w * c[wr.kz]);
+    t = scaled_t / det;
+    if (!(t > t_min && t < t_max))
+      return false;
+
+    b1 = v / det;
+    b2 = w / det;
+    return true;
+  }
+
+  void fill_record(const Ray &r, double t, uint32_t triangle, double b1,
+                   double b2, HitRecord &rec) const {
+    const auto *index = &data->indices[size_t(triangle) * 3];
+    const double b0 = 1 - b1 - b2;
+    const vec3 p0(data->positions[index[0]]);
+    const vec3 p1(data->positions[index[1]]);
+    const vec3 p2(data->positions[index[2]]);
+
+    rec.set(r.at(t), t, mat);
+    rec.object_id = id;
+
+    vec3 outward_normal = glm::cross(p1 - p0, p2 - p0);
+    if (data->has_normals()) {
+      auto shading_normal = b0 * vec3(data->normals[index[0]]) +
+                            b1 * vec3(data->normals[index[1]]) +
+                            b2 * vec3(data->normals[index[2]]);
+      // keep the side of the geometric normal
+      if (glm::dot(shading_normal, outward_normal) < 0)
+        shading_normal = -shading_normal;
+      outward_normal = shading_normal;
+    }
+    rec.set_face_normal(r, glm::normalize(outward_normal));
+
+    if (data->has_uvs()) {
+      auto uv = b0 * vec2(data->uvs[index[0]]) +
+                b1 * vec2(data->uvs[index[1]]) +
+                b2 * vec2(data->uvs[index[2]]);
+      rec.u = uv.x;
+      rec.v = uv.y;
+    } else {
+      rec.u = b1;
+      rec.v = b2;
+    }
+  }
+
+  static bool node_hit(const MeshBVHNode &node, const vec3 &origin,
+                       const vec3 &inv_dir, double t_min, double t_max) {
+    RENDER_STAT(aabb_tests);
+    for (int axis = 0; axis < 3; ++axis) {
+      auto t0 = (node.bmin[axis] - origin[axis]) * inv_dir[axis];
+      auto t1 = (node.bmax[axis] - origin[axis]) * inv_dir[axis];
+      if (t0 > t1)
+        std::swap(t0, t1);
+      t_min = t0 > t_min ? t0 : t_min;
+      t_max = t1 < t_max ? t1 : t_max;
+      if (t_max < t_min)
+        return false;
+    }
+    return true;
+  }
+};
+
+class MeshBVHBuilder {
+public:
+  MeshBVHBuilder(MeshData &_data) : data(_data) {}
+
+  void build() {
+    const auto n = uint32_t(data.triangle_count());
+    if (n == 0)
+      return;
+
+    std::vector<Bounds> tri_bounds(n);
+    std::vector<fvec3> centroids(n);
+    tri_order.resize(n);
+    for (uint32_t k = 0; k < n; ++k) {
+      for (int corner = 0; corner < 3; ++corner)
+        tri_bounds[k].grow(
+            data.positions[data.indices[size_t(k) * 3 + corner]]);
+      centroids[k] = (tri_bounds[k].min + tri_bounds[k].max) * 0.5f;
+      tri_order[k] = k;
+    }
+
+    nodes.reserve(2 * n / max_leaf_size + 1);
+    build_node(0, n, 0, tri_bounds, centroids);
+
+    data.nodes.assign(nodes.begin(), nodes.end());
+    data.tri_order.assign(tri_order.begin(), tri_order.end());
+  }
+
+private:
+  MeshData &data;
+  std::vector<MeshBVHNode> nodes;
+  std::vector<uint32_t> tri_order;
+
+  static const int max_leaf_size = 4;
+  static const int bin_count = 12;
+  // deeper nodes are leaves, or split at the median when there are more
+  // triangles than a leaf holds, which takes at most 17 more levels for
+  // 2^32 triangles, so MeshBVHNode::max_depth is never exceeded
+  static const int max_sah_depth = MeshBVHNode::max_depth - 17;
+
+  // bounds of triangles during the build
+  struct Bounds {
+    fvec3 min = fvec3(INFINITY, INFINITY, INFINITY);
+    fvec3 max = fvec3(-INFINITY, -INFINITY, -INFINITY);
+
+    void grow(const fvec3 &p) {
+      for (int axis = 0; axis < 3; ++axis) {
+        min[axis] = std::fmin(min[axis], p[axis]);
+        max[axis] = std::fmax(max[axis], p[axis]);
+      }
+    }
+
+    void grow(const Bounds &b) {
+      // an empty bin would add points at infinity
+      if (b.min.x > b.max.x)
+        return;
+      grow(b.min);
+      grow(b.max);
+    }
+
+    float area() const {
+      if (min.x > max.x)
+        return 0;
+      auto d = max - min;
+      return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+  };
+
+  uint32_t build_node(uint32_t start, uint32_t end, int depth,
+                      const std::vector<Bounds> &tri_bounds,
+                      const std::vector<fvec3> &centroids) {
+    const auto index = uint32_t(nodes.size());
+    nodes.emplace_back();
+
+    Bounds bounds, centroid_bounds;
+    for (auto k = start; k < end; ++k) {
+      bounds.grow(tri_bounds[tri_order[k]]);
+      centroid_bounds.grow(centroids[tri_order[k]]);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      nodes[index].bmin[axis] = bounds.min[axis];
+      nodes[index].bmax[axis] = bounds.max[axis];
+    }
+
+    const auto count = end - start;
+    auto make_leaf = [&] {
+      nodes[index].offset = start;
+      nodes[index].count = uint16_t(count);
+      nodes[index].axis = 0;
+      return index;
+    };
+    if (count <= max_leaf_size)
+      return make_leaf();
+
+    auto extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                   : (extent.y > extent.z ? 1 : 2);
+    // all centroids at one point: cannot split by position
+    if (extent[axis] <= 0 || depth >= max_sah_depth) {
+      if (count <= UINT16_MAX)
+        return make_leaf();
+      const auto mid = start + count / 2;
+      std::nth_element(tri_order.begin() + start, tri_order.begin() + mid,
+                       tri_order.begin() + end, [&](uint32_t a, uint32_t b) {
+                         return centroids[a][axis] < centroids[b][axis];
+                       });
+      return split_node(index, start, mid, end, depth, axis, tri_bounds,
+                        centroids);
+    }
+
+    // bin the centroids along the widest axis and sweep for the cheapest
+    // split
+    Bounds bins[bin_count];
+    uint32_t bin_counts[bin_count] = {};
+    auto bin_of = [&](uint32_t triangle) {
+      auto b = int(bin_count * (centroids[triangle][axis] -
+                                centroid_bounds.min[axis]) /
+                   extent[axis]);
+      return b < bin_count ? b : bin_count - 1;
+    };
+    for (auto k = start; k < end; ++k) {
+      auto b = bin_of(tri_order[k]);
+      bins[b].grow(tri_bounds[tri_order[k]]);
+      ++bin_counts[b];
+    }
+
+    float right_area[bin_count];
+    uint32_t right_count[bin_count];
+    Bounds right;
+    uint32_t right_total = 0;
+    for (int b = bin_count - 1; b > 0; --b) {
+      right.grow(bins[b]);
+      right_total += bin_counts[b];
+      right_area[b] = right.area();
+      right_count[b] = right_total;
+    }
+
+    Bounds left;
+    uint32_t left_total = 0;
+    float best_cost = INFINITY;
+    int best_split = -1;
+    for (int b = 1; b < bin_count; ++b) {
+      left.grow(bins[b - 1]);
+      left_total += bin_counts[b - 1];
+      if (left_total == 0 || right_count[b] == 0)
+        continue;
+      auto cost = left.area() * left_total + right_area[b] * right_count[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = b;
+      }
+    }
+
+    // intersecting the triangles directly is cheaper than splitting
+    const float traversal_cost = 1.f;
+    if (best_split < 0 ||
+        (count <= 16 &&
+         traversal_cost * bounds.area() + best_cost >= bounds.area() * count))
+      return make_leaf();
+
+    auto mid = std::partition(tri_order.begin() + start,
+                              tri_order.begin() + end, [&](uint32_t triangle) {
+                                return bin_of(triangle) < best_split;
+                              }) -
+               tri_order.begin();
+    return split_node(index, start, uint32_t(mid), end, depth, axis,
+                      tri_bounds, centroids);
+  }
+
+  uint32_t split_node(uint32_t index, uint32_t start, uint32_t mid,
+                      uint32_t end, int depth, int axis,
+                      const std::vector<Bounds> &tri_bounds,
+                      const std::vector<fvec3> &centroids) {
+    nodes[index].count = 0;
+    nodes[index].axis = uint16_t(axis);
+    build_node(start, mid, depth + 1, tri_bounds, centroids);
+    auto right = build_node(mid, end, depth + 1, tri_bounds, centroids);
+    nodes[index].offset = right;
+    return index;
+  }
+};
+
+inline void MeshData::build_bvh() {
+  TraceSpan span("build mesh bvh", "triangles", (long long)triangle_count());
+  MeshBVHBuilder(*this).build();
+}
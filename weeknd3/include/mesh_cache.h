@@ -0,0 +1,230 @@
+#pragma once
+#include "mapped_file.h"
+#include "mesh.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// binary cache of a mesh together with its built bvh
+// the file is a header followed by the flat arrays of MeshData, each at a
+// 64-byte aligned offset recorded in the header. loading maps the file and
+// points the buffers at those offsets: no parsing, no copies, no bvh build
+// a cache is only used when its version, the element layout and the size
+// and modification time of the source file all match
+// only the header is checked on load (its checksum, the section sizes against
+// the file), the arrays are trusted: the file is written by write_mesh_cache
+// and renamed into place whole
+
+static const char MESH_CACHE_MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+// bump whenever MeshData, MeshBVHNode or the header change
+static const uint32_t MESH_CACHE_VERSION = 2;
+static const uint32_t MESH_CACHE_ENDIAN_PROBE = 0x01020304;
+
+enum MeshCacheArray {
+  CachedPositions,
+  CachedNormals,
+  CachedUvs,
+  CachedIndices,
+  CachedNodes,
+  CachedTriOrder,
+  CachedArrayCount
+};
+
+struct MeshCacheSection {
+  uint64_t offset = 0;
+  uint64_t count = 0;
+};
+
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_probe;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint32_t element_size[CachedArrayCount];
+  MeshCacheSection sections[CachedArrayCount];
+  // of the bytes above
+  uint64_t checksum;
+};
+
+// fnv-1a over the header without its checksum
+inline uint64_t mesh_cache_checksum(const MeshCacheHeader &header) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(&header);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t k = 0; k < offsetof(MeshCacheHeader, checksum); ++k)
+    hash = (hash ^ bytes[k]) * 0x100000001b3ull;
+  return hash;
+}
+
+// the cache is kept next to the source (<filename>.cache) unless
+// RTW_MESH_CACHE names a directory for all caches. when the source directory
+// is not writable the cache goes to the temporary directory instead
+// candidates are returned in the order they are tried
+inline std::vector<std::string>
+get_mesh_cache_filenames(const std::string &source_filename) {
+  namespace fs = std::filesystem;
+  std::error_code error;
+  auto absolute = fs::absolute(source_filename, error).string();
+  if (error)
+    absolute = source_filename;
+  // the directory is shared by sources of the same name
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), ".%016llx.cache",
+                (unsigned long long)std::hash<std::string>()(absolute));
+  const auto shared_name = fs::path(source_filename).filename().string() +
+                           suffix;
+
+  if (const char *directory = std::getenv("RTW_MESH_CACHE"))
+    return {(fs::path(directory) / shared_name).string()};
+  auto temporary = fs::temp_directory_path(error);
+  if (error)
+    return {source_filename + ".cache"};
+  return {source_filename + ".cache", (temporary / shared_name).string()};
+}
+
+// size and modification time (ns) of a file, false if it does not exist
+inline bool get_file_stamp(const std::string &filename, uint64_t &size,
+                           int64_t &mtime) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    return false;
+  size = uint64_t(st.st_size);
+  mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+inline void fill_mesh_cache_sizes(MeshCacheHeader &header) {
+  header.element_size[CachedPositions] = sizeof(fvec3);
+  header.element_size[CachedNormals] = sizeof(fvec3);
+  header.element_size[CachedUvs] = sizeof(fvec2);
+  header.element_size[CachedIndices] = sizeof(uint32_t);
+  header.element_size[CachedNodes] = sizeof(MeshBVHNode);
+  header.element_size[CachedTriOrder] = sizeof(uint32_t);
+}
+
+// the mesh must have its bvh built
+// written to a temporary file first, so a crash never leaves a torn cache
+inline bool write_mesh_cache(const std::string &cache_filename,
+                             const MeshData &data,
+                             const std::string &source_filename) {
+  MeshCacheHeader header = {};
+  std::copy(MESH_CACHE_MAGIC, MESH_CACHE_MAGIC + 8, header.magic);
+  header.version = MESH_CACHE_VERSION;
+  header.endian_probe = MESH_CACHE_ENDIAN_PROBE;
+  if (!data.has_bvh() ||
+      !get_file_stamp(source_filename, header.source_size,
+                      header.source_mtime))
+    return false;
+  fill_mesh_cache_sizes(header);
+
+  const char *arrays[CachedArrayCount] = {
+      reinterpret_cast<const char *>(data.positions.data()),
+      reinterpret_cast<const char *>(data.normals.data()),
+      reinterpret_cast<const char *>(data.uvs.data()),
+      reinterpret_cast<const char *>(data.indices.data()),
+      reinterpret_cast<const char *>(data.nodes.data()),
+      reinterpret_cast<const char *>(data.tri_order.data())};
+  const size_t counts[CachedArrayCount] = {
+      data.positions.size(), data.normals.size(), data.uvs.size(),
+      data.indices.size(),   data.nodes.size(),   data.tri_order.size()};
+
+  const uint64_t alignment = 64;
+  uint64_t offset = sizeof(MeshCacheHeader);
+  for (int a = 0; a < CachedArrayCount; ++a) {
+    offset = (offset + alignment - 1) / alignment * alignment;
+    header.sections[a].offset = offset;
+    header.sections[a].count = counts[a];
+    offset += counts[a] * header.element_size[a];
+  }
+  header.checksum = mesh_cache_checksum(header);
+
+  const auto temporary = cache_filename + ".tmp";
+  {
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    if (!output)
+      return false;
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+    static const char padding[alignment] = {};
+    for (int a = 0; a < CachedArrayCount; ++a) {
+      output.write(padding, header.sections[a].offset - written);
+      output.write(arrays[a], counts[a] * header.element_size[a]);
+      written = header.sections[a].offset + counts[a] * header.element_size[a];
+    }
+    if (!output)
+      return false;
+  }
+  return std::rename(temporary.c_str(), cache_filename.c_str()) == 0;
+}
+
+template <typename T>
+inline bool view_mesh_cache_section(Buffer<T> &buffer,
+                                    const MeshCacheSection &section,
+                                    const shared_ptr<MappedFile> &file) {
+  if (section.offset % alignof(T) != 0 || section.offset > file->size() ||
+      section.count > (file->size() - section.offset) / sizeof(T))
+    return false;
+  if (section.count == 0)
+    buffer.clear();
+  else
+    buffer.view(reinterpret_cast<const T *>(file->data() + section.offset),
+                section.count, file);
+  return true;
+}
+
+// sizes that MeshData relies on, checked without reading the arrays
+inline bool has_valid_mesh_cache_sizes(const MeshData &data) {
+  const auto vertex_count = data.positions.size();
+  return data.indices.size() % 3 == 0 &&
+         (!data.has_normals() || data.normals.size() == vertex_count) &&
+         (!data.has_uvs() || data.uvs.size() == vertex_count) &&
+         data.tri_order.size() == data.triangle_count() && data.has_bvh();
+}
+
+// nullptr if there is no usable cache for the source file
+inline shared_ptr<MeshData>
+load_mesh_cache(const std::string &cache_filename,
+                const std::string &source_filename) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!get_file_stamp(source_filename, source_size, source_mtime))
+    return nullptr;
+
+  // the bvh is read in traversal order, not front to back
+  auto file = make_shared<MappedFile>(cache_filename, MADV_WILLNEED);
+  if (!file->is_open() || file->size() < sizeof(MeshCacheHeader))
+    return nullptr;
+
+  MeshCacheHeader expected = {};
+  fill_mesh_cache_sizes(expected);
+  // copied out, the mapping gives no alignment or aliasing guarantees
+  MeshCacheHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (header.checksum != mesh_cache_checksum(header) ||
+      !std::equal(MESH_CACHE_MAGIC, MESH_CACHE_MAGIC + 8, header.magic) ||
+      header.version != MESH_CACHE_VERSION ||
+      header.endian_probe != MESH_CACHE_ENDIAN_PROBE ||
+      header.source_size != source_size ||
+      header.source_mtime != source_mtime ||
+      !std::equal(expected.element_size,
+                  expected.element_size + CachedArrayCount,
+                  header.element_size))
+    return nullptr;
+
+  auto data = make_shared<MeshData>();
+  const auto &sections = header.sections;
+  if (!view_mesh_cache_section(data->positions, sections[CachedPositions],
+                               file) ||
+      !view_mesh_cache_section(data->normals, sections[CachedNormals], file) ||
+      !view_mesh_cache_section(data->uvs, sections[CachedUvs], file) ||
+      !view_mesh_cache_section(data->indices, sections[CachedIndices], file) ||
+      !view_mesh_cache_section(data->nodes, sections[CachedNodes], file) ||
+      !view_mesh_cache_section(data->tri_order, sections[CachedTriOrder],
+                               file) ||
+      !has_valid_mesh_cache_sizes(*data))
+    return nullptr;
+  return data;
+}
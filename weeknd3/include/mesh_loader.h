@@ -0,0 +1,698 @@
+#pragma once
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "mesh.h"
+#include "parallel.h"
+#include "trace.h"
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+// mesh loaders for wavefront obj and ply
+// the file is memory mapped and split into chunks that are parsed on all
+// threads, numbers are read in place with from_chars and written straight
+// into the MeshData arrays
+// on failure an error is printed and nullptr is returned
+
+inline const char *skip_spaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+inline const char *find_line_end(const char *p, const char *end) {
+  auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+  return eol ? eol : end;
+}
+
+inline bool parse_float(const char *&p, const char *end, float &value) {
+  p = skip_spaces(p, end);
+  if (p < end && *p == '+')
+    ++p;
+  auto result = std::from_chars(p, end, value);
+  if (result.ec != std::errc())
+    return false;
+  p = result.ptr;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// obj
+
+// one corner of a face, 0-based, -1 if the attribute is not given
+struct ObjCorner {
+  int32_t v = -1, vt = -1, vn = -1;
+
+  bool operator==(const ObjCorner &other) const {
+    return v == other.v && vt == other.vt && vn == other.vn;
+  }
+};
+
+struct ObjCornerHash {
+  size_t operator()(const ObjCorner &c) const {
+    return (size_t(uint32_t(c.v)) * 0x9E3779B97F4A7C15ull) ^
+           (size_t(uint32_t(c.vt)) * 0xC2B2AE3D27D4EB4Full) ^
+           (size_t(uint32_t(c.vn)) * 0x165667B19E3779F9ull);
+  }
+};
+
+// a range of whole lines of the file
+struct ObjChunk {
+  const char *begin = nullptr;
+  const char *end = nullptr;
+  // v, vt and vn lines in this chunk, and before it
+  size_t count[3] = {0, 0, 0};
+  size_t offset[3] = {0, 0, 0};
+  // 3 per triangle, polygons are split into fans
+  std::vector<ObjCorner> corners;
+  bool is_valid = true;
+};
+
+// 0 for v, 1 for vt, 2 for vn, -1 otherwise
+inline int obj_attribute(const char *p, const char *eol) {
+  if (eol - p < 2 || p[0] != 'v')
+    return -1;
+  if (p[1] == ' ' || p[1] == '\t')
+    return 0;
+  if (eol - p < 3 || (p[2] != ' ' && p[2] != '\t'))
+    return -1;
+  return p[1] == 't' ? 1 : (p[1] == 'n' ? 2 : -1);
+}
+
+// positive indices count from 1, negative ones back from the last attribute
+// defined so far
+inline bool parse_obj_index(const char *&p, const char *eol, size_t defined,
+                            int32_t &index) {
+  long long raw = 0;
+  auto result = std::from_chars(p, eol, raw);
+  if (result.ec != std::errc() || raw == 0)
+    return false;
+  p = result.ptr;
+  index = int32_t(raw > 0 ? raw - 1 : (long long)(defined) + raw);
+  return index >= 0;
+}
+
+inline void count_obj_chunk(ObjChunk &chunk) {
+  for (auto p = chunk.begin; p < chunk.end;) {
+    auto eol = find_line_end(p, chunk.end);
+    auto attribute = obj_attribute(skip_spaces(p, eol), eol);
+    if (attribute >= 0)
+      ++chunk.count[attribute];
+    p = eol + 1;
+  }
+}
+
+inline void parse_obj_chunk(ObjChunk &chunk, MeshData &data) {
+  size_t defined[3] = {chunk.offset[0], chunk.offset[1], chunk.offset[2]};
+  std::vector<ObjCorner> polygon;
+
+  for (auto p = chunk.begin; p < chunk.end && chunk.is_valid;) {
+    auto eol = find_line_end(p, chunk.end);
+    auto line = skip_spaces(p, eol);
+    p = eol + 1;
+
+    auto attribute = obj_attribute(line, eol);
+    if (attribute == 0) {
+      auto q = line + 2;
+      auto &position = data.positions[defined[0]++];
+      chunk.is_valid = parse_float(q, eol, position.x) &&
+                       parse_float(q, eol, position.y) &&
+                       parse_float(q, eol, position.z);
+    } else if (attribute == 1) {
+      // an optional third texture coordinate is ignored
+      auto q = line + 3;
+      auto &uv = data.uvs[defined[1]++];
+      chunk.is_valid = parse_float(q, eol, uv.x) && parse_float(q, eol, uv.y);
+    } else if (attribute == 2) {
+      auto q = line + 3;
+      auto &normal = data.normals[defined[2]++];
+      chunk.is_valid = parse_float(q, eol, normal.x) &&
+                       parse_float(q, eol, normal.y) &&
+                       parse_float(q, eol, normal.z);
+    } else if (eol - line >= 2 && line[0] == 'f' &&
+               (line[1] == ' ' || line[1] == '\t')) {
+      // v, v/vt, v//vn or v/vt/vn
+      polygon.clear();
+      for (auto q = skip_spaces(line + 2, eol);
+           q < eol && *q != '\r' && *q != '#'; q = skip_spaces(q, eol)) {
+        ObjCorner corner;
+        bool is_valid = parse_obj_index(q, eol, defined[0], corner.v);
+        if (is_valid && q < eol && *q == '/') {
+          ++q;
+          if (q < eol && *q != '/')
+            is_valid = parse_obj_index(q, eol, defined[1], corner.vt);
+          if (is_valid && q < eol && *q == '/') {
+            ++q;
+            is_valid = parse_obj_index(q, eol, defined[2], corner.vn);
+          }
+        }
+        if (!is_valid) {
+          chunk.is_valid = false;
+          break;
+        }
+        polygon.push_back(corner);
+      }
+      for (size_t k = 2; k < polygon.size(); ++k) {
+        chunk.corners.push_back(polygon[0]);
+        chunk.corners.push_back(polygon[k - 1]);
+        chunk.corners.push_back(polygon[k]);
+      }
+    }
+  }
+}
+
+// turn obj corners into a single index buffer
+// when every corner uses the same index for all of its attributes the
+// arrays are used as they are, otherwise each distinct (v, vt, vn) becomes
+// its own vertex
+inline bool build_obj_indices(const std::vector<ObjCorner> &corners,
+                              MeshData &data) {
+  const auto n_positions = data.positions.size();
+  bool use_uvs = !data.uvs.empty();
+  bool use_normals = !data.normals.empty();
+  bool is_shared = true;
+  for (const auto &c : corners) {
+    if (size_t(c.v) >= n_positions ||
+        (c.vt >= 0 && size_t(c.vt) >= data.uvs.size()) ||
+        (c.vn >= 0 && size_t(c.vn) >= data.normals.size()))
+      return false;
+    use_uvs = use_uvs && c.vt >= 0;
+    use_normals = use_normals && c.vn >= 0;
+  }
+  for (const auto &c : corners)
+    is_shared = is_shared && (!use_uvs || c.vt == c.v) &&
+                (!use_normals || c.vn == c.v);
+  is_shared = is_shared && (!use_uvs || data.uvs.size() == n_positions) &&
+              (!use_normals || data.normals.size() == n_positions);
+
+  data.indices.resize(corners.size());
+  if (is_shared) {
+    for (size_t k = 0; k < corners.size(); ++k)
+      data.indices[k] = uint32_t(corners[k].v);
+    if (!use_uvs)
+      data.uvs.clear();
+    if (!use_normals)
+      data.normals.clear();
+    return true;
+  }
+
+  MeshData split;
+  std::unordered_map<ObjCorner, uint32_t, ObjCornerHash> vertices;
+  vertices.reserve(n_positions);
+  for (size_t k = 0; k < corners.size(); ++k) {
+    auto key = corners[k];
+    if (!use_uvs)
+      key.vt = -1;
+    if (!use_normals)
+      key.vn = -1;
+    auto inserted = vertices.emplace(key, uint32_t(split.positions.size()));
+    if (inserted.second) {
+      split.positions.push_back(data.positions[key.v]);
+      if (use_uvs)
+        split.uvs.push_back(data.uvs[key.vt]);
+      if (use_normals)
+        split.normals.push_back(data.normals[key.vn]);
+    }
+    data.indices[k] = inserted.first->second;
+  }
+  data.positions.swap(split.positions);
+  data.uvs.swap(split.uvs);
+  data.normals.swap(split.normals);
+  return true;
+}
+
+inline shared_ptr<MeshData> load_obj(const std::string &filename,
+                                     const int threads = 0) {
+  MappedFile file(filename);
+  if (!file.is_open()) {
+    std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+    return nullptr;
+  }
+
+  // split at line boundaries, a few chunks per thread for load balance
+  const size_t min_chunk_size = 1 << 20;
+  size_t chunk_count =
+      std::min(size_t(get_thread_count(threads)) * 4,
+               std::max<size_t>(1, file.size() / min_chunk_size));
+  std::vector<ObjChunk> chunks;
+  for (auto p = file.begin(); p < file.end();) {
+    auto step = std::min<size_t>(file.end() - p, file.size() / chunk_count);
+    auto end = std::min(find_line_end(p + step, file.end()) + 1, file.end());
+    chunks.emplace_back();
+    chunks.back().begin = p;
+    chunks.back().end = end;
+    p = end;
+  }
+  const int n_chunks = int(chunks.size());
+
+  // pass 1: count attributes so that every chunk knows where its own go
+  parallel_for(
+      0, n_chunks, [&](int k) { count_obj_chunk(chunks[k]); }, threads);
+  size_t total[3] = {0, 0, 0};
+  for (auto &chunk : chunks) {
+    for (int a = 0; a < 3; ++a) {
+      chunk.offset[a] = total[a];
+      total[a] += chunk.count[a];
+    }
+  }
+
+  // pass 2: parse numbers into their final place
+  auto data = make_shared<MeshData>();
+  data->positions.resize(total[0]);
+  data->uvs.resize(total[1]);
+  data->normals.resize(total[2]);
+  parallel_for(
+      0, n_chunks, [&](int k) { parse_obj_chunk(chunks[k], *data); },
+      threads);
+
+  std::vector<ObjCorner> corners;
+  size_t corner_count = 0;
+  for (const auto &chunk : chunks) {
+    if (!chunk.is_valid) {
+      std::cerr << "ERROR: Could not parse mesh file '" << filename << "'.\n";
+      return nullptr;
+    }
+    corner_count += chunk.corners.size();
+  }
+  corners.reserve(corner_count);
+  for (auto &chunk : chunks) {
+    corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+    std::vector<ObjCorner>().swap(chunk.corners);
+  }
+
+  if (!build_obj_indices(corners, *data)) {
+    std::cerr << "ERROR: Index out of range in mesh file '" << filename
+              << "'.\n";
+    return nullptr;
+  }
+  return data;
+}
+
+// ----------------------------------------------------------------------------
+// ply, binary only
+
+enum class PlyType {
+  Int8,
+  UInt8,
+  Int16,
+  UInt16,
+  Int32,
+  UInt32,
+  Float32,
+  Float64,
+  Invalid
+};
+
+inline PlyType ply_type(const std::string &name) {
+  if (name == "char" || name == "int8")
+    return PlyType::Int8;
+  if (name == "uchar" || name == "uint8")
+    return PlyType::UInt8;
+  if (name == "short" || name == "int16")
+    return PlyType::Int16;
+  if (name == "ushort" || name == "uint16")
+    return PlyType::UInt16;
+  if (name == "int" || name == "int32")
+    return PlyType::Int32;
+  if (name == "uint" || name == "uint32")
+    return PlyType::UInt32;
+  if (name == "float" || name == "float32")
+    return PlyType::Float32;
+  if (name == "double" || name == "float64")
+    return PlyType::Float64;
+  return PlyType::Invalid;
+}
+
+inline size_t ply_type_size(PlyType type) {
+  static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+  return sizes[int(type)];
+}
+
+template <typename T> inline T read_ply_raw(const char *p, bool swap_bytes) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap_bytes)
+    std::reverse(bytes, bytes + sizeof(T));
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+inline double read_ply_value(const char *p, PlyType type, bool swap_bytes) {
+  switch (type) {
+  case PlyType::Int8:
+    return read_ply_raw<int8_t>(p, swap_bytes);
+  case PlyType::UInt8:
+    return read_ply_raw<uint8_t>(p, swap_bytes);
+  case PlyType::Int16:
+    return read_ply_raw<int16_t>(p, swap_bytes);
+  case PlyType::UInt16:
+    return read_ply_raw<uint16_t>(p, swap_bytes);
+  case PlyType::Int32:
+    return read_ply_raw<int32_t>(p, swap_bytes);
+  case PlyType::UInt32:
+    return read_ply_raw<uint32_t>(p, swap_bytes);
+  case PlyType::Float32:
+    return read_ply_raw<float>(p, swap_bytes);
+  case PlyType::Float64:
+    return read_ply_raw<double>(p, swap_bytes);
+  default:
+    return 0;
+  }
+}
+
+struct PlyProperty {
+  std::string name;
+  PlyType type = PlyType::Invalid;
+  // lists only
+  bool is_list = false;
+  PlyType count_type = PlyType::Invalid;
+  // byte offset inside the element, for fixed size elements
+  size_t offset = 0;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count = 0;
+  std::vector<PlyProperty> properties;
+  // 0 if the element has a list property
+  size_t stride = 0;
+
+  int find(std::initializer_list<const char *> names) const {
+    for (size_t k = 0; k < properties.size(); ++k)
+      for (auto name : names)
+        if (properties[k].name == name)
+          return int(k);
+    return -1;
+  }
+};
+
+inline bool parse_ply_header(const MappedFile &file,
+                             std::vector<PlyElement> &elements,
+                             bool &swap_bytes, const char *&body) {
+  static const char end_header[] = "end_header";
+  auto header_end = std::search(file.begin(), file.end(), end_header,
+                                end_header + sizeof(end_header) - 1);
+  if (file.size() < 3 || std::memcmp(file.data(), "ply", 3) != 0 ||
+      header_end == file.end())
+    return false;
+  body = find_line_end(header_end, file.end()) + 1;
+
+  const uint16_t probe = 1;
+  const bool is_little_endian = *reinterpret_cast<const char *>(&probe) == 1;
+
+  std::istringstream header(std::string(file.begin(), header_end));
+  std::string line;
+  bool has_format = false;
+  while (std::getline(header, line)) {
+    std::istringstream tokens(line);
+    std::string keyword;
+    tokens >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      tokens >> format;
+      if (format == "binary_little_endian")
+        swap_bytes = !is_little_endian;
+      else if (format == "binary_big_endian")
+        swap_bytes = is_little_endian;
+      else
+        return false;
+      has_format = true;
+    } else if (keyword == "element") {
+      elements.emplace_back();
+      tokens >> elements.back().name >> elements.back().count;
+    } else if (keyword == "property") {
+      if (elements.empty())
+        return false;
+      PlyProperty property;
+      std::string type;
+      tokens >> type;
+      if (type == "list") {
+        std::string count_type;
+        tokens >> count_type >> type;
+        property.is_list = true;
+        property.count_type = ply_type(count_type);
+        if (property.count_type == PlyType::Invalid)
+          return false;
+      }
+      property.type = ply_type(type);
+      tokens >> property.name;
+      if (property.type == PlyType::Invalid)
+        return false;
+      elements.back().properties.push_back(property);
+    }
+  }
+
+  for (auto &element : elements) {
+    size_t offset = 0;
+    bool is_fixed = true;
+    for (auto &property : element.properties) {
+      property.offset = offset;
+      is_fixed = is_fixed && !property.is_list;
+      offset += ply_type_size(property.type);
+    }
+    element.stride = is_fixed ? offset : 0;
+  }
+  return has_format;
+}
+
+inline bool parse_ply_vertices(const PlyElement &element, const char *body,
+                               bool swap_bytes, MeshData &data, int threads) {
+  const int x = element.find({"x"});
+  const int y = element.find({"y"});
+  const int z = element.find({"z"});
+  const int nx = element.find({"nx"});
+  const int ny = element.find({"ny"});
+  const int nz = element.find({"nz"});
+  const int u = element.find({"u", "s", "texture_u", "texture_s"});
+  const int v = element.find({"v", "t", "texture_v", "texture_t"});
+  if (element.stride == 0 || x < 0 || y < 0 || z < 0)
+    return false;
+  const bool has_normals = nx >= 0 && ny >= 0 && nz >= 0;
+  const bool has_uvs = u >= 0 && v >= 0;
+
+  const auto n = element.count;
+  data.positions.resize(n);
+  data.normals.resize(has_normals ? n : 0);
+  data.uvs.resize(has_uvs ? n : 0);
+
+  auto read = [&](const char *vertex, int property) {
+    const auto &p = element.properties[property];
+    return float(read_ply_value(vertex + p.offset, p.type, swap_bytes));
+  };
+  const size_t block_size = 1 << 16;
+  const int blocks = int((n + block_size - 1) / block_size);
+  parallel_for(
+      0, blocks,
+      [&](int block) {
+        const auto end = std::min(n, (block + 1) * block_size);
+        for (size_t k = block * block_size; k < end; ++k) {
+          auto vertex = body + k * element.stride;
+          data.positions[k] =
+              fvec3(read(vertex, x), read(vertex, y), read(vertex, z));
+          if (has_normals)
+            data.normals[k] =
+                fvec3(read(vertex, nx), read(vertex, ny), read(vertex, nz));
+          if (has_uvs)
+            data.uvs[k] = fvec2(read(vertex, u), read(vertex, v));
+        }
+      },
+      threads);
+  return true;
+}
+
+// returns the end of the face element, or nullptr if it could not be read
+inline const char *parse_ply_faces(const PlyElement &element, const char *body,
+                                   const char *end, bool swap_bytes,
+                                   MeshData &data, int threads) {
+  const int list = element.find({"vertex_indices", "vertex_index"});
+  if (list < 0 || !element.properties[list].is_list)
+    return nullptr;
+  const auto n = element.count;
+
+  // fast path: the index list is the only property and every face is a
+  // triangle, so faces have a fixed stride and can be read in parallel
+  if (element.properties.size() == 1) {
+    const auto &p = element.properties[0];
+    const auto count_size = ply_type_size(p.count_type);
+    const auto index_size = ply_type_size(p.type);
+    const auto stride = count_size + 3 * index_size;
+    if (body + n * stride <= end) {
+      data.indices.resize(n * 3);
+      std::atomic<bool> is_triangles(true);
+      const size_t block_size = 1 << 16;
+      const int blocks = int((n + block_size - 1) / block_size);
+      parallel_for(
+          0, blocks,
+          [&](int block) {
+            const auto block_end = std::min(n, (block + 1) * block_size);
+            for (size_t k = block * block_size; k < block_end; ++k) {
+              auto face = body + k * stride;
+              if (read_ply_value(face, p.count_type, swap_bytes) != 3) {
+                is_triangles = false;
+                return;
+              }
+              for (int corner = 0; corner < 3; ++corner)
+                data.indices[k * 3 + corner] = uint32_t(read_ply_value(
+                    face + count_size + corner * index_size, p.type,
+                    swap_bytes));
+            }
+          },
+          threads);
+      if (is_triangles)
+        return body + n * stride;
+    }
+  }
+
+  // general case: walk the faces, polygons are split into fans
+  data.indices.clear();
+  data.indices.reserve(n * 3);
+  auto p = body;
+  for (size_t k = 0; k < n; ++k) {
+    for (int property = 0; property < int(element.properties.size());
+         ++property) {
+      const auto &prop = element.properties[property];
+      if (!prop.is_list) {
+        p += ply_type_size(prop.type);
+        continue;
+      }
+      const auto count_size = ply_type_size(prop.count_type);
+      const auto index_size = ply_type_size(prop.type);
+      if (p + count_size > end)
+        return nullptr;
+      auto count = size_t(read_ply_value(p, prop.count_type, swap_bytes));
+      p += count_size;
+      if (p + count * index_size > end)
+        return nullptr;
+      if (property == list) {
+        auto index = [&](size_t corner) {
+          return uint32_t(
+              read_ply_value(p + corner * index_size, prop.type, swap_bytes));
+        };
+        for (size_t corner = 2; corner < count; ++corner) {
+          data.indices.push_back(index(0));
+          data.indices.push_back(index(corner - 1));
+          data.indices.push_back(index(corner));
+        }
+      }
+      p += count * index_size;
+    }
+  }
+  return p;
+}
+
+inline shared_ptr<MeshData> load_ply(const std::string &filename,
+                                     const int threads = 0) {
+  MappedFile file(filename);
+  if (!file.is_open()) {
+    std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+    return nullptr;
+  }
+
+  std::vector<PlyElement> elements;
+  bool swap_bytes = false;
+  const char *p = nullptr;
+  if (!parse_ply_header(file, elements, swap_bytes, p)) {
+    std::cerr << "ERROR: Unsupported ply header in '" << filename
+              << "', only binary ply is supported.\n";
+    return nullptr;
+  }
+
+  auto data = make_shared<MeshData>();
+  bool has_vertices = false, has_faces = false;
+  for (const auto &element : elements) {
+    if (has_vertices && has_faces)
+      break;
+    if (element.name == "vertex") {
+      if (p + element.count * element.stride > file.end() ||
+          !parse_ply_vertices(element, p, swap_bytes, *data, threads))
+        break;
+      p += element.count * element.stride;
+      has_vertices = true;
+    } else if (element.name == "face") {
+      p = parse_ply_faces(element, p, file.end(), swap_bytes, *data, threads);
+      if (!p)
+        break;
+      has_faces = true;
+    } else if (element.stride > 0) {
+      p += element.count * element.stride;
+    } else {
+      break;
+    }
+  }
+  if (!has_vertices || !has_faces) {
+    std::cerr << "ERROR: Could not parse mesh file '" << filename << "'.\n";
+    return nullptr;
+  }
+
+  for (auto index : data->indices) {
+    if (index >= data->positions.size()) {
+      std::cerr << "ERROR: Index out of range in mesh file '" << filename
+                << "'.\n";
+      return nullptr;
+    }
+  }
+  return data;
+}
+
+// picks the loader from the file extension
+// with use_cache, a binary cache with the bvh already built is kept (see
+// get_mesh_cache_filenames) and mapped instead of parsing the source again
+inline shared_ptr<MeshData> load_mesh(const std::string &filename,
+                                      const int threads = 0,
+                                      const bool use_cache = true) {
+  TraceSpan span("load mesh");
+  auto begin = std::chrono::steady_clock::now();
+  auto seconds = [&] {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         begin)
+        .count();
+  };
+
+  const auto cache_filenames = get_mesh_cache_filenames(filename);
+  if (use_cache) {
+    for (const auto &cache_filename : cache_filenames) {
+      if (auto data = load_mesh_cache(cache_filename, filename)) {
+        std::clog << "loaded " << filename << " from cache: "
+                  << data->triangle_count() << " triangles in " << seconds()
+                  << " s" << std::endl;
+        return data;
+      }
+    }
+  }
+
+  auto dot = filename.find_last_of('.');
+  auto extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  shared_ptr<MeshData> data;
+  if (extension == "obj")
+    data = load_obj(filename, threads);
+  else if (extension == "ply")
+    data = load_ply(filename, threads);
+  else
+    std::cerr << "ERROR: Unknown mesh format '" << filename << "'.\n";
+  if (!data)
+    return nullptr;
+
+  std::clog << "loaded " << filename << ": " << data->triangle_count()
+            << " triangles in " << seconds() << " s" << std::endl;
+  if (use_cache) {
+    data->build_bvh();
+    bool is_written = false;
+    for (const auto &cache_filename : cache_filenames) {
+      if (write_mesh_cache(cache_filename, *data, filename)) {
+        is_written = true;
+        break;
+      }
+    }
+    if (!is_written)
+      std::clog << "could not write mesh cache " << cache_filenames.back()
+                << std::endl;
+  }
+  return data;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "ray.h"
+
+// number of camera rays traced together, 4, 8 or 16
+#ifndef PACKET_SIZE
+#define PACKET_SIZE 8
+#endif
+
+// rays stored as structure of arrays so that every per-lane loop over a
+// packet compiles to vector instructions
+class RayPacket {
+public:
+  static const int size = PACKET_SIZE;
+
+  double ox[size], oy[size], oz[size];
+  double dx[size], dy[size], dz[size];
+  // inverse directions for the slab test
+  double inv_dx[size], inv_dy[size], inv_dz[size];
+  double time[size];
+  // lanes past the image border are inactive
+  bool active[size];
+
+  RayPacket() {
+    for (int lane = 0; lane < size; ++lane)
+      clear(lane);
+  }
+
+  void clear(int lane) {
+    ox[lane] = oy[lane] = oz[lane] = 0;
+    dx[lane] = dy[lane] = dz[lane] = 1;
+    inv_dx[lane] = inv_dy[lane] = inv_dz[lane] = 1;
+    time[lane] = 0;
+    active[lane] = false;
+  }
+
+  void set(int lane, const Ray &r) {
+    ox[lane] = r.origin().x;
+    oy[lane] = r.origin().y;
+    oz[lane] = r.origin().z;
+    dx[lane] = r.direction().x;
+    dy[lane] = r.direction().y;
+    dz[lane] = r.direction().z;
+    time[lane] = r.time();
+    active[lane] = true;
+    update_inverse(lane);
+  }
+
+  void update_inverse(int lane) {
+    inv_dx[lane] = 1. / dx[lane];
+    inv_dy[lane] = 1. / dy[lane];
+    inv_dz[lane] = 1. / dz[lane];
+  }
+
+  int active_count() const {
+    int count = 0;
+    for (int lane = 0; lane < size; ++lane)
+      count += active[lane];
+    return count;
+  }
+
+  Ray ray(int lane) const {
+    return Ray(vec3(ox[lane], oy[lane], oz[lane]),
+               vec3(dx[lane], dy[lane], dz[lane]), time[lane]);
+  }
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// 0 means one thread per hardware thread
+inline int get_thread_count(int requested = 0) {
+  if (requested > 0)
+    return requested;
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// run fn(index) for every index in [begin, end) on a group of threads
+// indices are handed out one by one, so rows (or tiles) of uneven cost still
+// keep every thread busy
+inline void parallel_for(int begin, int end, const std::function<void(int)> &fn,
+                         int threads = 0) {
+  threads = std::min(get_thread_count(threads), end - begin);
+  if (threads <= 1) {
+    for (int index = begin; index < end; ++index)
+      fn(index);
+    return;
+  }
+
+  std::atomic<int> next(begin);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+      for (int index = next++; index < end; index = next++)
+        fn(index);
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+}
@@ -2,6 +2,8 @@
 #include "common.h"
 #include "hittable.h"
 #include "onb.h"
+#include "sampler.h"
+#include "stats.h"
 
 class PDF {
 public:
@@ -9,6 +11,8 @@ public:
 
   virtual double value(const vec3 &direction) const = 0;
   virtual vec3 generate() const = 0;
+  // draw the direction from the sampler instead of random_double()
+  virtual vec3 generate(Sampler &sampler) const { return generate(); }
 };
 
 class SpherePDF : public PDF {
@@ -18,6 +22,10 @@ public:
   double value(const vec3 &direction) const override { return 1 / (4 * PI); }
 
   vec3 generate() const override { return random_unit_vec3(); }
+
+  vec3 generate(Sampler &sampler) const override {
+    return random_unit_vec3(sampler.get_2d());
+  }
 };
 
 class CosinePDF : public PDF {
@@ -35,6 +43,10 @@ public:
     return uvw.transform(random_cosine_direction());
   }
 
+  vec3 generate(Sampler &sampler) const override {
+    return uvw.transform(random_cosine_direction(sampler.get_2d()));
+  }
+
 private:
   ONB uvw;
 };
@@ -50,11 +62,31 @@ public:
 
   vec3 generate() const override { return objects.random(origin); }
 
+  vec3 generate(Sampler &sampler) const override {
+    return objects.random(origin, sampler.get_2d());
+  }
+
 private:
   const Hittable &objects;
   vec3 origin;
 };
 
+// pdfs allocated while tracing are made here, the one place that counts
+// allocations
+template <typename T, typename... Args>
+inline shared_ptr<T> make_pdf(Args &&...args) {
+  RENDER_STAT(allocations);
+  return make_shared<T>(std::forward<Args>(args)...);
+}
+
+// probability of sampling towards the lights instead of the material
+// scenes without lights (lit by the background) only sample the material:
+// an even mix would pick an object of the empty light list half of the time,
+// which reads past its end
+inline double get_light_mix_rate(const Hittable &lights) {
+  return lights.get_bbox().is_empty() ? 0. : 0.5;
+}
+
 class MixturePDF : public PDF {
 public:
   MixturePDF(shared_ptr<PDF> _p0, shared_ptr<PDF> _p1, double _mix_rate = 0.5)
@@ -69,6 +101,11 @@ public:
     return random_double() < mix_rate ? p0->generate() : p1->generate();
   }
 
+  vec3 generate(Sampler &sampler) const override {
+    return sampler.get_1d() < mix_rate ? p0->generate(sampler)
+                                       : p1->generate(sampler);
+  }
+
 private:
   shared_ptr<PDF> p0, p1;
   double mix_rate;
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// hardware cache-miss counter of the calling thread
+// falls back to "unavailable" when the kernel (or a container) does not allow
+// perf events, in which case read() returns -1
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+#endif
+  }
+
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd >= 0)
+      close(fd);
+#endif
+  }
+
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  CacheMissCounter &operator=(const CacheMissCounter &) = delete;
+
+  bool available() const { return fd >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    if (fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+  }
+
+  // total since construction
+  int64_t read() const {
+#ifdef __linux__
+    int64_t count = 0;
+    if (fd >= 0 && ::read(fd, &count, sizeof(count)) == sizeof(count))
+      return count;
+#endif
+    return -1;
+  }
+
+private:
+  int fd = -1;
+};
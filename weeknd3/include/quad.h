@@ -31,7 +31,7 @@ public:
     // similar to light sampling here, in fact it is only used for light
     // sampling in our case
     auto distance_squared = rec.t * rec.t * glm::dot(direction, direction);
-    auto cosine = std::fabs(dot(direction, rec.normal) / glm::length(direction));
+    auto cosine = std::fabs(dot(direction, normal) / glm::length(direction));
 
     return distance_squared / (cosine * area);
   }
@@ -41,12 +41,18 @@ public:
     return p - origin;
   }
 
+  vec3 random(const vec3 &origin, const vec2 &sample) const override {
+    auto p = Q + (sample.x * u) + (sample.y * v);
+    return p - origin;
+  }
+
   AABB get_bbox() const override { return bbox; }
 
   // check parallelism
   // check aabb box
   // check intersection
   bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    RENDER_STAT(quad_tests);
     auto denom = glm::dot(normal, r.direction());
 
     // No hit if the ray is parallel to the plane.
@@ -69,11 +75,58 @@ public:
     if (!is_interior(alpha, beta, rec))
       return false;
 
-    // Ray hits the 2D shape; set the rest of the hit record and return true.
+    // Ray hits the 2D shape; the rest of the hit record is set by finalize().
+    rec.t = t;
+    rec.object = this;
+    return true;
+  }
 
-    rec.set(intersection, t, mat);
+  void finalize(const Ray &r, HitRecord &rec) const override {
+    rec.set(r.at(rec.t), rec.t, mat);
     rec.set_face_normal(r, normal);
-    return true;
+    rec.object_id = id;
+  }
+
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    RENDER_STAT_ADD(quad_tests, packet.active_count());
+    double ts[RayPacket::size], alphas[RayPacket::size], betas[RayPacket::size];
+    bool valid[RayPacket::size];
+    bool any = false;
+
+    // plane test and plane coordinates of all lanes at once
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      auto denom = normal.x * packet.dx[lane] + normal.y * packet.dy[lane] +
+                   normal.z * packet.dz[lane];
+      auto t = (D - (normal.x * packet.ox[lane] + normal.y * packet.oy[lane] +
+                     normal.z * packet.oz[lane])) /
+               denom;
+      // planar_hitpt_vector = intersection - Q
+      auto px = packet.ox[lane] + t * packet.dx[lane] - Q.x;
+      auto py = packet.oy[lane] + t * packet.dy[lane] - Q.y;
+      auto pz = packet.oz[lane] + t * packet.dz[lane] - Q.z;
+      // dot(w, cross(p, v)) and dot(w, cross(u, p))
+      alphas[lane] = w.x * (py * v.z - pz * v.y) +
+                     w.y * (pz * v.x - px * v.z) + w.z * (px * v.y - py * v.x);
+      betas[lane] = w.x * (u.y * pz - u.z * py) + w.y * (u.z * px - u.x * pz) +
+                    w.z * (u.x * py - u.y * px);
+      ts[lane] = t;
+      valid[lane] = packet.active[lane] && std::fabs(denom) >= 1e-8 &&
+                    t_min <= t && t <= hits.t_max[lane];
+      any |= valid[lane];
+    }
+    if (!any)
+      return;
+
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      auto &rec = hits.rec[lane];
+      if (!valid[lane] || !is_interior(alphas[lane], betas[lane], rec))
+        continue;
+      rec.t = ts[lane];
+      rec.object = this;
+      hits.t_max[lane] = ts[lane];
+      hits.is_hit[lane] = true;
+    }
   }
 
   virtual bool is_interior(double a, double b, HitRecord &rec) const {
@@ -102,38 +155,3 @@ private:
   vec3 w;
   double area;
 };
-
-// a & b are corners
-inline shared_ptr<HittableList> box(const vec3 &a, const vec3 &b,
-                                    shared_ptr<Material> mat) {
-  // Returns the 3D box (six sides) that contains the two opposite vertices a &
-  // b.
-
-  auto sides = make_shared<HittableList>();
-
-  // Construct the two opposite vertices with the minimum and maximum
-  // coordinates.
-  auto min =
-      vec3(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z));
-  auto max =
-      vec3(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z));
-
-  auto dx = vec3(max.x - min.x, 0, 0);
-  auto dy = vec3(0, max.y - min.y, 0);
-  auto dz = vec3(0, 0, max.z - min.z);
-
-  sides->add(make_shared<Quad>(vec3(min.x, min.y, max.z), dx, dy,
-                               mat)); // front
-  sides->add(make_shared<Quad>(vec3(max.x, min.y, max.z), -dz, dy,
-                               mat)); // right
-  sides->add(make_shared<Quad>(vec3(max.x, min.y, min.z), -dx, dy,
-                               mat)); // back
-  sides->add(make_shared<Quad>(vec3(min.x, min.y, min.z), dz, dy,
-                               mat)); // left
-  sides->add(make_shared<Quad>(vec3(min.x, max.y, max.z), dx, -dz,
-                               mat)); // top
-  sides->add(make_shared<Quad>(vec3(min.x, min.y, min.z), dx, dz,
-                               mat)); // bottom
-
-  return sides;
-}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include "aabb.h"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// spread the lower 10 bits of v so that there are two zeros between bits
+inline uint32_t expand_bits_10(uint32_t v) {
+  v &= 0x3ffu;
+  v = (v * 0x00010001u) & 0xff0000ffu;
+  v = (v * 0x00000101u) & 0x0f00f00fu;
+  v = (v * 0x00000011u) & 0xc30c30c3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// 30-bit morton code of a point in the unit cube
+inline uint32_t morton3(double x, double y, double z) {
+  auto quantize = [](double t) {
+    return uint32_t(std::fmin(std::fmax(t * 1024., 0.), 1023.));
+  };
+  return (expand_bits_10(quantize(x)) << 2) |
+         (expand_bits_10(quantize(y)) << 1) | expand_bits_10(quantize(z));
+}
+
+// sort key of a ray for coherent traversal
+// the direction octant comes first since rays of the same octant visit bvh
+// children in the same order, then the morton code of the origin inside the
+// scene bounds, then the morton code of the direction
+inline uint64_t ray_sort_key(const vec3 &origin, const vec3 &direction,
+                             const AABB &bounds) {
+  uint64_t octant = (direction.x < 0 ? 4 : 0) | (direction.y < 0 ? 2 : 0) |
+                    (direction.z < 0 ? 1 : 0);
+  auto relative = [&](int axis) {
+    const auto &ax = bounds.axis_interval(axis);
+    return ax.size() > 0 ? (origin[axis] - ax.min) / ax.size() : 0.;
+  };
+  auto unit_direction = glm::normalize(direction);
+  uint64_t origin_code = morton3(relative(0), relative(1), relative(2));
+  uint64_t direction_code =
+      morton3(unit_direction.x * 0.5 + 0.5, unit_direction.y * 0.5 + 0.5,
+              unit_direction.z * 0.5 + 0.5);
+  return (octant << 60) | (origin_code << 30) | direction_code;
+}
+
+// the order in which rays should be traced, keys[order[0]] is the smallest
+inline void sort_by_key(const std::vector<uint64_t> &keys,
+                        std::vector<int> &order) {
+  order.resize(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](int a, int b) { return keys[a] < keys[b]; });
+}
+
+// gather values into the given order
+template <typename T>
+void apply_order(std::vector<T> &values, const std::vector<int> &order) {
+  std::vector<T> sorted(values.size());
+  for (size_t k = 0; k < order.size(); ++k)
+    sorted[k] = values[order[k]];
+  values.swap(sorted);
+}
@@ -0,0 +1,232 @@
+#pragma once
+#include "common.h"
+#include <cstdint>
+#include <vector>
+
+// samplers hand out per-dimension values of one pixel sample
+// the camera and the integrator consume dimensions in a fixed order, so the
+// n-th dimension of every sample in a pixel comes from the same low-discrepancy
+// sequence and stays well stratified
+enum class SamplerType { Independent, Halton, Sobol };
+
+// largest double below 1
+const double ONE_MINUS_EPSILON = 0x1.fffffffffffffp-1;
+
+// integer hash (from murmur3 finalizer), good enough to decorrelate pixels
+inline uint32_t hash_u32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x85ebca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35u;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+  return hash_u32(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline double u32_to_unit(uint32_t x) {
+  return std::fmin(x * 0x1p-32, ONE_MINUS_EPSILON);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// hash-based owen scrambling
+// Burley, Practical Hash-based Owen Scrambling, JCGT 2020
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+  x = reverse_bits(x);
+  x = laine_karras_permutation(x, seed);
+  x = reverse_bits(x);
+  return x;
+}
+
+// the first two sobol dimensions as 0.32 fixed point
+// dimension 0 is exactly the van der corput sequence
+inline uint32_t sobol_dim0(uint32_t index) { return reverse_bits(index); }
+
+inline uint32_t sobol_dim1(uint32_t index) {
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    if (index & 1)
+      result ^= v;
+  return result;
+}
+
+class Sampler {
+public:
+  Sampler(uint32_t _seed = 0) : seed(_seed) {}
+  virtual ~Sampler() = default;
+
+  // called once before the samples of pixel (i, j) are taken
+  virtual void start_pixel(int i, int j) {
+    pixel_seed = hash_combine(hash_combine(seed, uint32_t(i)), uint32_t(j));
+  }
+
+  // called before each sample of the current pixel
+  virtual void start_sample(int index) {
+    sample_index = uint32_t(index);
+    dimension = 0;
+    key_random();
+  }
+
+  // jump to a fixed dimension, so that every bounce of every sample reads
+  // the same dimensions no matter how many values the last bounce consumed
+  void set_dimension(int _dimension) {
+    dimension = _dimension;
+    key_random();
+  }
+
+  // keys the random_double() stream of the thread by the pixel, sample and
+  // dimension, done by start_sample() and set_dimension() so that the values
+  // materials and media draw between two of them belong to the path
+  // stream tells apart several keys at the same dimension
+  void key_random(uint32_t stream = 0) const {
+    seed_random(uint64_t(hash_combine(pixel_seed, sample_index)) << 32 |
+                hash_combine(uint32_t(dimension), stream));
+  }
+
+  virtual double get_1d() = 0;
+  virtual vec2 get_2d() = 0;
+
+protected:
+  uint32_t seed;
+  uint32_t pixel_seed = 0;
+  uint32_t sample_index = 0;
+  int dimension = 0;
+};
+
+// plain monte carlo, every dimension is a hash of the pixel, the sample and
+// the dimension
+class IndependentSampler : public Sampler {
+public:
+  using Sampler::Sampler;
+
+  double get_1d() override { return sample(dimension++); }
+
+  vec2 get_2d() override {
+    auto x = sample(dimension++);
+    auto y = sample(dimension++);
+    return vec2(x, y);
+  }
+
+private:
+  double sample(int dim) const {
+    return u32_to_unit(hash_combine(hash_combine(pixel_seed, sample_index),
+                                    uint32_t(dim)));
+  }
+};
+
+// halton sequence with a per-pixel, per-dimension toroidal shift
+// (cranley-patterson rotation) to decorrelate neighbouring pixels
+class HaltonSampler : public Sampler {
+public:
+  using Sampler::Sampler;
+
+  double get_1d() override { return sample(dimension++); }
+
+  vec2 get_2d() override {
+    auto x = sample(dimension++);
+    auto y = sample(dimension++);
+    return vec2(x, y);
+  }
+
+private:
+  static const int max_dimension = 256;
+
+  double sample(int dim) const {
+    // high dimensions of halton are badly correlated, fall back to a hash
+    if (dim >= max_dimension)
+      return u32_to_unit(hash_combine(hash_combine(pixel_seed, sample_index),
+                                      uint32_t(dim)));
+    auto offset = u32_to_unit(hash_combine(pixel_seed, uint32_t(dim)));
+    auto x = radical_inverse(get_primes()[dim], sample_index) + offset;
+    return x >= 1 ? x - 1 : x;
+  }
+
+  static double radical_inverse(int base, uint32_t a) {
+    const double inv_base = 1. / base;
+    double inv_base_n = 1;
+    uint64_t reversed = 0;
+    while (a) {
+      uint32_t next = a / base;
+      uint32_t digit = a - next * base;
+      reversed = reversed * base + digit;
+      inv_base_n *= inv_base;
+      a = next;
+    }
+    return std::fmin(reversed * inv_base_n, ONE_MINUS_EPSILON);
+  }
+
+  static const std::vector<int> &get_primes() {
+    static const std::vector<int> primes = [] {
+      std::vector<int> p;
+      for (int n = 2; int(p.size()) < max_dimension; ++n) {
+        bool is_prime = true;
+        for (auto q : p) {
+          if (q * q > n)
+            break;
+          if (n % q == 0) {
+            is_prime = false;
+            break;
+          }
+        }
+        if (is_prime)
+          p.push_back(n);
+      }
+      return p;
+    }();
+    return primes;
+  }
+};
+
+// owen-scrambled sobol, padded: every 1d/2d request is an independently
+// shuffled and scrambled copy of the first one/two sobol dimensions
+class SobolSampler : public Sampler {
+public:
+  using Sampler::Sampler;
+
+  double get_1d() override {
+    auto dim_seed = hash_combine(pixel_seed, uint32_t(dimension++));
+    auto index = nested_uniform_scramble(sample_index, dim_seed);
+    return u32_to_unit(
+        nested_uniform_scramble(sobol_dim0(index), hash_u32(dim_seed)));
+  }
+
+  vec2 get_2d() override {
+    auto dim_seed = hash_combine(pixel_seed, uint32_t(dimension));
+    dimension += 2;
+    auto index = nested_uniform_scramble(sample_index, dim_seed);
+    auto x = nested_uniform_scramble(sobol_dim0(index), hash_u32(dim_seed));
+    auto y = nested_uniform_scramble(sobol_dim1(index),
+                                     hash_u32(dim_seed ^ 0x5bd1e995u));
+    return vec2(u32_to_unit(x), u32_to_unit(y));
+  }
+};
+
+inline shared_ptr<Sampler> make_sampler(SamplerType type, uint32_t seed = 0) {
+  switch (type) {
+  case SamplerType::Halton:
+    return make_shared<HaltonSampler>(seed);
+  case SamplerType::Sobol:
+    return make_shared<SobolSampler>(seed);
+  default:
+    return make_shared<IndependentSampler>(seed);
+  }
+}
@@ -0,0 +1,651 @@
+#pragma once
+#include "bvh.h"
+#include "box.h"
+#include "camera.h"
+#include "hittable.h"
+#include "instance.h"
+#include "medium.h"
+#include "mesh_loader.h"
+#include "quad.h"
+#include "sphere_set.h"
+#include "sphere.h"
+#include "texture.h"
+#include "trace.h"
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+// scene description files
+// one statement per line, '#' starts a comment, names are single words
+//
+//   camera width 640 height 640 spp 1024 depth 50 vfov 40
+//          from 278 278 -800 at 278 278 0 up 0 1 0
+//          defocus 0 focus 10 background 0 0 0     (any subset, on one line)
+//   sampler independent|halton|sobol
+//   seed <n>                  seeds the render and the noise textures
+//                             defined after it, 0 by default
+//   integrator recursive|wavefront
+//   denoise on|off, sort_rays on|off, packets on|off
+//   threads <n>               rows rendered in parallel, 0 for all cores
+//   aov <prefix>
+//   stats <file.json>         counters of a -DRENDER_STATS=ON build as json
+//   heatmap <file.ppm> [time|steps]   false-color cost per pixel, steps
+//                             needs -DRENDER_STATS=ON
+//
+//   texture <name> solid <r g b>
+//   texture <name> checker <scale> <even texture> <odd texture>
+//   texture <name> noise <scale> <depth> [turbulence on|off] [marble on|off]
+//
+//   material <name> lambertian <r g b> | lambertian texture <texture>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <refraction index>
+//   material <name> light <r g b> | light texture <texture>
+//   material <name> isotropic <r g b>
+//
+//   sphere <material> <center> <radius> [moving <center at time 1>]
+//   quad <material> <Q> <u> <v>
+//   box <material> <corner> <opposite corner>    (not flat on any axis)
+//   mesh <material> <file.obj|file.ply>     (relative to the scene file)
+//
+//   begin ... end             block, transforms and media apply inside only
+//   translate <x y z>         applied to the block's primitives, the last
+//   rotate_x|y|z <degrees>    transform of a block is applied first
+//   scale <s> | <x y z>
+//   medium <density> <r g b>  the block's primitives become the boundaries
+//                             of constant media, their material is unused
+//
+//   object <name> ... end     primitives inside define a shared object (with
+//                             its own bvh) instead of being added to the world
+//   instance <name>           places the object with the enclosing blocks'
+//                             transforms, instances share the object's memory
+//
+// spheres, quads and boxes with a light material are also sampled as lights,
+// so they must not be inside objects or non-uniformly scaled, and meshes
+// cannot have one
+class Scene {
+public:
+  HittableList world;
+  HittableList lights;
+  // the camera keeps a reference to lights
+  std::unique_ptr<Camera> camera;
+
+  void render() { camera->render(world); }
+};
+
+class SceneLoader {
+public:
+  SceneLoader(const std::string &_filename) : filename(_filename) {
+    auto slash = filename.find_last_of('/');
+    directory =
+        slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+  }
+
+  // nullptr after printing the first error
+  shared_ptr<Scene> load() {
+    std::ifstream input(filename);
+    if (!input) {
+      std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+      return nullptr;
+    }
+
+    scene = make_shared<Scene>();
+    blocks.assign(1, Block());
+    // noise textures draw their tables from the stream, which is reseeded so
+    // that they do not depend on what the thread has drawn before
+    seed_random(seed);
+    std::string line;
+    for (line_number = 1; std::getline(input, line); ++line_number) {
+      auto comment = line.find('#');
+      if (comment != std::string::npos)
+        line.resize(comment);
+      tokens.clear();
+      tokens.str(line);
+      std::string keyword;
+      if (!(tokens >> keyword))
+        continue;
+      if (!parse_statement(keyword))
+        return nullptr;
+      std::string extra;
+      if (tokens >> extra) {
+        error("unexpected '" + extra + "'");
+        return nullptr;
+      }
+    }
+    if (blocks.size() != 1) {
+      error("missing 'end'");
+      return nullptr;
+    }
+
+    make_sphere_sets(spheres, scene->world);
+    if (instances->size() > 0) {
+      instances->build();
+      scene->world.add(instances);
+    }
+    if (!scene->world.objects.empty())
+      scene->world = HittableList(make_shared<BVHNode>(scene->world));
+    scene->camera = std::make_unique<Camera>(
+        width, height, scene->lights, spp, max_depth, vfov, lookfrom, lookat,
+        vup, defocus_angle, focus_dist, background);
+    scene->camera->set_sampler(sampler_type);
+    scene->camera->set_seed(seed);
+    scene->camera->set_integrator(integrator);
+    scene->camera->set_denoise(denoise);
+    scene->camera->set_ray_sorting(sort_rays);
+    scene->camera->set_packet_tracing(packet_tracing);
+    scene->camera->set_aov_output(aov_prefix);
+    scene->camera->set_threads(threads);
+    scene->camera->set_stats_output(stats_output);
+    scene->camera->set_heatmap_output(heatmap_output, heatmap_metric);
+    return scene;
+  }
+
+private:
+  struct Block {
+    // product of the block's own transforms
+    Affine transform;
+    bool is_transformed = false;
+    bool is_medium = false;
+    double density = 0;
+    color albedo;
+    // primitives go to this list instead of the world, set in an object
+    // definition and in the blocks inside it
+    shared_ptr<HittableList> object;
+    // only on the block that starts the object definition
+    std::string object_name;
+  };
+
+  std::string filename;
+  std::string directory;
+  int line_number = 0;
+  std::istringstream tokens;
+
+  shared_ptr<Scene> scene;
+  std::vector<Block> blocks;
+  std::map<std::string, shared_ptr<Texture>> textures;
+  std::map<std::string, shared_ptr<Material>> materials;
+  std::set<std::string> light_materials;
+  std::map<std::string, shared_ptr<Hittable>> objects;
+  shared_ptr<InstanceBVH> instances = make_shared<InstanceBVH>();
+  std::vector<SphereDesc> spheres;
+
+  // camera and render options, the defaults of Camera
+  int width = 640, height = 360, spp = 32, max_depth = 48;
+  double vfov = 20, defocus_angle = 0.6, focus_dist = 10;
+  vec3 lookfrom = vec3(13, 2, 3), lookat = vec3(0, 0, 0), vup = vec3(0, 1, 0);
+  color background = color(0.70, 0.80, 1.00);
+  SamplerType sampler_type = SamplerType::Sobol;
+  uint32_t seed = 0;
+  IntegratorType integrator = IntegratorType::Recursive;
+  bool denoise = false, sort_rays = false, packet_tracing = false;
+  std::string aov_prefix, stats_output, heatmap_output;
+  CostMetric heatmap_metric = CostMetric::Time;
+  int threads = 1;
+
+  bool has_error = false;
+
+  // always false, so that parsers can return it
+  bool error(const std::string &message) {
+    std::cerr << "ERROR: " << filename << ":" << line_number << ": " << message
+              << "\n";
+    has_error = true;
+    return false;
+  }
+
+  template <typename T> bool read(T &value) { return bool(tokens >> value); }
+
+  bool read(vec3 &value) {
+    return read(value.x) && read(value.y) && read(value.z);
+  }
+
+  bool read_switch(bool &value) {
+    std::string word;
+    if (!read(word))
+      return false;
+    value = word == "on" || word == "1" || word == "true";
+    return value || word == "off" || word == "0" || word == "false";
+  }
+
+  template <typename T>
+  bool find(const std::map<std::string, shared_ptr<T>> &names,
+            shared_ptr<T> &value, const char *kind) {
+    std::string name;
+    if (!read(name))
+      return false;
+    auto found = names.find(name);
+    if (found == names.end())
+      return error(std::string("unknown ") + kind + " '" + name + "'");
+    value = found->second;
+    return true;
+  }
+
+  bool parse_statement(const std::string &keyword) {
+    bool is_valid = false;
+    if (keyword == "camera")
+      is_valid = parse_camera();
+    else if (keyword == "sampler")
+      is_valid = parse_sampler();
+    else if (keyword == "seed") {
+      // read wider, unsigned extraction would wrap negative numbers
+      long long value;
+      is_valid = read(value) && value >= 0 && value <= UINT32_MAX;
+      if (is_valid) {
+        seed = uint32_t(value);
+        seed_random(seed);
+      }
+    } else if (keyword == "integrator")
+      is_valid = parse_integrator();
+    else if (keyword == "denoise")
+      is_valid = read_switch(denoise);
+    else if (keyword == "sort_rays")
+      is_valid = read_switch(sort_rays);
+    else if (keyword == "packets")
+      is_valid = read_switch(packet_tracing);
+    else if (keyword == "aov")
+      is_valid = read(aov_prefix);
+    else if (keyword == "stats")
+      is_valid = read(stats_output);
+    else if (keyword == "heatmap")
+      is_valid = parse_heatmap();
+    else if (keyword == "threads")
+      is_valid = read(threads) && threads >= 0;
+    else if (keyword == "texture")
+      is_valid = parse_texture();
+    else if (keyword == "material")
+      is_valid = parse_material();
+    else if (keyword == "sphere" || keyword == "quad" || keyword == "box" ||
+             keyword == "mesh")
+      is_valid = parse_primitive(keyword);
+    else if (keyword == "begin") {
+      blocks.push_back(blocks.back());
+      blocks.back().transform = Affine();
+      blocks.back().is_transformed = false;
+      blocks.back().object_name.clear();
+      is_valid = true;
+    } else if (keyword == "end") {
+      if (blocks.size() == 1)
+        return error("'end' without 'begin'");
+      is_valid = end_block();
+    } else if (keyword == "object") {
+      is_valid = begin_object();
+    } else if (keyword == "instance") {
+      is_valid = parse_instance();
+    } else if (keyword == "translate" || keyword == "rotate_x" ||
+               keyword == "rotate_y" || keyword == "rotate_z" ||
+               keyword == "scale") {
+      is_valid = parse_transform(keyword);
+    } else if (keyword == "medium") {
+      auto &block = blocks.back();
+      block.is_medium = read(block.density) && read(block.albedo);
+      is_valid = block.is_medium && block.density > 0;
+    } else {
+      return error("unknown statement '" + keyword + "'");
+    }
+    // some parsers report a more precise error themselves
+    if (!is_valid && !has_error)
+      error("invalid '" + keyword + "'");
+    return is_valid;
+  }
+
+  bool parse_camera() {
+    std::string key;
+    while (read(key)) {
+      bool is_valid = false;
+      if (key == "width")
+        is_valid = read(width) && width > 0;
+      else if (key == "height")
+        is_valid = read(height) && height > 0;
+      else if (key == "spp")
+        is_valid = read(spp) && spp > 0;
+      else if (key == "depth")
+        is_valid = read(max_depth);
+      else if (key == "vfov")
+        is_valid = read(vfov);
+      else if (key == "from")
+        is_valid = read(lookfrom);
+      else if (key == "at")
+        is_valid = read(lookat);
+      else if (key == "up")
+        is_valid = read(vup);
+      else if (key == "defocus")
+        is_valid = read(defocus_angle);
+      else if (key == "focus")
+        is_valid = read(focus_dist);
+      else if (key == "background")
+        is_valid = read(background);
+      if (!is_valid)
+        return false;
+    }
+    // the loop stops at the end of the line
+    tokens.clear();
+    return true;
+  }
+
+  bool parse_sampler() {
+    std::string type;
+    if (!read(type))
+      return false;
+    if (type == "independent")
+      sampler_type = SamplerType::Independent;
+    else if (type == "halton")
+      sampler_type = SamplerType::Halton;
+    else if (type == "sobol")
+      sampler_type = SamplerType::Sobol;
+    else
+      return false;
+    return true;
+  }
+
+  bool parse_heatmap() {
+    if (!read(heatmap_output))
+      return false;
+    std::string metric;
+    if (!read(metric)) {
+      // the metric is optional
+      tokens.clear();
+      heatmap_metric = CostMetric::Time;
+      return true;
+    }
+    if (metric == "time")
+      heatmap_metric = CostMetric::Time;
+    else if (metric == "steps")
+      heatmap_metric = CostMetric::Steps;
+    else
+      return false;
+    return true;
+  }
+
+  bool parse_integrator() {
+    std::string type;
+    if (!read(type))
+      return false;
+    if (type == "recursive")
+      integrator = IntegratorType::Recursive;
+    else if (type == "wavefront")
+      integrator = IntegratorType::Wavefront;
+    else
+      return false;
+    return true;
+  }
+
+  bool parse_texture() {
+    std::string name, type;
+    if (!read(name) || !read(type))
+      return false;
+    shared_ptr<Texture> texture;
+    if (type == "solid") {
+      color albedo;
+      if (!read(albedo))
+        return false;
+      texture = make_shared<SolidColor>(albedo);
+    } else if (type == "checker") {
+      double scale;
+      shared_ptr<Texture> even, odd;
+      if (!read(scale) || !find(textures, even, "texture") ||
+          !find(textures, odd, "texture"))
+        return false;
+      texture = make_shared<CheckerTexture>(scale, even, odd);
+    } else if (type == "noise") {
+      double scale;
+      int depth;
+      bool use_turb = true, marbled = true;
+      if (!read(scale) || !read(depth))
+        return false;
+      std::string option;
+      while (read(option)) {
+        if (!(option == "turbulence" && read_switch(use_turb)) &&
+            !(option == "marble" && read_switch(marbled)))
+          return false;
+      }
+      tokens.clear();
+      texture = make_shared<NoiseTexture>(scale, depth, use_turb, marbled);
+    } else {
+      return false;
+    }
+    textures[name] = texture;
+    return true;
+  }
+
+  // either a color or 'texture <name>'
+  bool read_texture(shared_ptr<Texture> &texture) {
+    auto position = tokens.tellg();
+    std::string word;
+    if (read(word) && word == "texture")
+      return find(textures, texture, "texture");
+    tokens.clear();
+    tokens.seekg(position);
+    color albedo;
+    if (!read(albedo))
+      return false;
+    texture = make_shared<SolidColor>(albedo);
+    return true;
+  }
+
+  bool parse_material() {
+    std::string name, type;
+    if (!read(name) || !read(type))
+      return false;
+    shared_ptr<Material> material;
+    shared_ptr<Texture> texture;
+    color albedo;
+    double value;
+    if (type == "lambertian" && read_texture(texture))
+      material = make_shared<Lambertian>(texture);
+    else if (type == "metal" && read(albedo) && read(value))
+      material = make_shared<Metal>(albedo, value);
+    else if (type == "dielectric" && read(value))
+      material = make_shared<Dielectric>(value);
+    else if (type == "light" && read_texture(texture))
+      material = make_shared<DiffuseLight>(texture);
+    else if (type == "isotropic" && read_texture(texture))
+      material = make_shared<Isotropic>(texture);
+    else
+      return false;
+    materials[name] = material;
+    if (type == "light")
+      light_materials.insert(name);
+    else
+      light_materials.erase(name);
+    return true;
+  }
+
+  bool parse_primitive(const std::string &type) {
+    std::string material_name;
+    if (!read(material_name))
+      return false;
+    shared_ptr<Material> material;
+    // boundaries of media do not need a material
+    if (material_name != "none") {
+      auto found = materials.find(material_name);
+      if (found == materials.end())
+        return error("unknown material '" + material_name + "'");
+      material = found->second;
+    }
+
+    shared_ptr<Hittable> object;
+    if (type == "sphere") {
+      vec3 center;
+      double radius;
+      if (!read(center) || !read(radius))
+        return false;
+      std::string moving;
+      vec3 center_end = center;
+      bool is_moving = read(moving);
+      if (is_moving) {
+        if (moving != "moving" || !read(center_end))
+          return false;
+      } else {
+        tokens.clear();
+      }
+      // plain spheres of the world are intersected in sets at the end
+      Affine unused;
+      const auto &block = blocks.back();
+      if (material && !block.is_medium && !block.object &&
+          !collect_transforms(unused)) {
+        spheres.push_back(SphereDesc{center, center_end, radius, material});
+        // sets cannot be sampled, the light gets a sphere of its own
+        if (light_materials.count(material_name))
+          scene->lights.add(
+              make_shared<Sphere>(center, center_end, radius, material));
+        return true;
+      }
+      if (is_moving)
+        object = make_shared<Sphere>(center, center_end, radius, material);
+      else
+        object = make_shared<Sphere>(center, radius, material);
+    } else if (type == "quad") {
+      vec3 q, u, v;
+      if (!read(q) || !read(u) || !read(v))
+        return false;
+      object = make_shared<Quad>(q, u, v, material);
+    } else if (type == "box") {
+      vec3 a, b;
+      if (!read(a) || !read(b))
+        return false;
+      // uvs and the light sampling pdf divide by the extent and face areas
+      auto extent = glm::abs(b - a);
+      if (!(extent.x > 0 && extent.y > 0 && extent.z > 0))
+        return error("box must not be flat, use a quad instead");
+      object = make_shared<Box>(a, b, material);
+    } else {
+      std::string mesh_filename;
+      if (!read(mesh_filename))
+        return false;
+      if (mesh_filename[0] != '/')
+        mesh_filename = directory + mesh_filename;
+      auto data = load_mesh(mesh_filename);
+      if (!data)
+        return false;
+      object = make_shared<TriangleMesh>(data, material);
+    }
+
+    // the whole stack of transforms becomes one Transform, those outside an
+    // object definition belong to its instances
+    Affine object_to_world;
+    bool is_transformed = collect_transforms(object_to_world);
+    if (is_transformed)
+      object = make_shared<Transform>(object, object_to_world);
+
+    const auto &block = blocks.back();
+    if (block.is_medium) {
+      object = make_shared<ConstantMedium>(object, block.density, block.albedo);
+    } else if (light_materials.count(material_name)) {
+      // lights are sampled where they are, which is only known for objects
+      // in the world and for transforms that keep the sampling density
+      if (type == "mesh")
+        return error("light material on mesh cannot be sampled");
+      if (block.object)
+        return error("light material on " + type +
+                     " cannot be sampled inside an object");
+      if (is_transformed && !object_to_world.is_similarity())
+        return error("light material on " + type +
+                     " cannot be sampled with a non-uniform scale");
+      scene->lights.add(object);
+    }
+    if (!material && !block.is_medium)
+      return error("only media boundaries can have material 'none'");
+    if (block.object)
+      block.object->add(object);
+    else
+      scene->world.add(object);
+    return true;
+  }
+
+  bool begin_object() {
+    std::string name;
+    if (!read(name))
+      return false;
+    if (blocks.back().object)
+      return error("objects cannot be defined inside objects");
+    Block block;
+    block.object = make_shared<HittableList>();
+    block.object_name = name;
+    blocks.push_back(block);
+    return true;
+  }
+
+  bool end_block() {
+    auto block = blocks.back();
+    blocks.pop_back();
+    if (block.object_name.empty())
+      return true;
+    const auto &list = block.object->objects;
+    if (list.empty())
+      return error("object '" + block.object_name + "' is empty");
+    // the bottom level bvh, shared by all the instances
+    objects[block.object_name] =
+        list.size() == 1 ? list[0] : make_shared<BVHNode>(*block.object);
+    return true;
+  }
+
+  bool parse_instance() {
+    shared_ptr<Hittable> object;
+    if (!find(objects, object, "object"))
+      return false;
+    if (blocks.back().object)
+      return error("instances cannot be placed inside objects");
+    if (blocks.back().is_medium)
+      return error("instances cannot be media boundaries");
+
+    Affine object_to_world;
+    collect_transforms(object_to_world);
+    instances->add(object, object_to_world);
+    return true;
+  }
+
+  bool parse_transform(const std::string &keyword) {
+    Affine step;
+    if (keyword == "translate") {
+      vec3 offset;
+      if (!read(offset))
+        return false;
+      step = Affine::translate(offset);
+    } else if (keyword == "scale") {
+      vec3 factor;
+      if (!read(factor.x))
+        return false;
+      // a single factor scales uniformly
+      if (!read(factor.y)) {
+        tokens.clear();
+        factor.y = factor.z = factor.x;
+      } else if (!read(factor.z)) {
+        return false;
+      }
+      if (factor.x == 0 || factor.y == 0 || factor.z == 0)
+        return error("scale factors cannot be zero");
+      step = Affine::scale(factor);
+    } else {
+      double angle;
+      if (!read(angle))
+        return false;
+      step = Affine::rotate(keyword[7] - 'x', angle);
+    }
+    // the last transform of a block is applied first
+    auto &block = blocks.back();
+    block.transform = block.transform * step;
+    block.is_transformed = true;
+    return true;
+  }
+
+  // product of the transforms of the enclosing blocks, outermost first,
+  // stopping at an object definition. false if there is no transform at all
+  bool collect_transforms(Affine &object_to_world) {
+    auto first = blocks.begin();
+    for (auto block = blocks.begin(); block != blocks.end(); ++block)
+      if (!block->object_name.empty())
+        first = block;
+    bool is_transformed = false;
+    for (auto block = first; block != blocks.end(); ++block) {
+      if (!block->is_transformed)
+        continue;
+      object_to_world = object_to_world * block->transform;
+      is_transformed = true;
+    }
+    return is_transformed;
+  }
+};
+
+inline shared_ptr<Scene> load_scene(const std::string &filename) {
+  TraceSpan span("load scene");
+  return SceneLoader(filename).load();
+}
@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "hittable.h"
+#include "onb.h"
 #include <glm/glm.hpp>
 
 // directly modify u & v instead of returning a vector
@@ -13,8 +14,8 @@ inline void get_sphere_uv(const vec3 &dir, double &u, double &v) {
   //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
   //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-  auto theta = std::acos(-dir.y);
-  auto phi = std::atan2(-dir.z, dir.x) + PI;
+  auto theta = fast_acos(-dir.y);
+  auto phi = fast_atan2(-dir.z, dir.x) + PI;
 
   u = phi / (2 * PI);
   v = theta / PI;
@@ -29,6 +30,7 @@ public:
         mat(_mat) {
     auto half_bbox = vec3(radius, radius, radius);
     bbox = AABB(static_center - half_bbox, static_center + half_bbox);
+    bbox_begin = bbox_end = bbox;
   }
 
   // moving sphere
@@ -37,17 +39,28 @@ public:
       : center(center_begin, center_end - center_begin),
         radius(std::fmax(0, _radius)), mat(_mat) {
     auto half_bbox = vec3(radius, radius, radius);
-    AABB box1(center.at(0) - half_bbox, center.at(0) + half_bbox);
-    AABB box2(center.at(1) - half_bbox, center.at(1) + half_bbox);
-    bbox = AABB(box1, box2);
+    bbox_begin = AABB(center.at(0) - half_bbox, center.at(0) + half_bbox);
+    bbox_end = AABB(center.at(1) - half_bbox, center.at(1) + half_bbox);
+    bbox = AABB(bbox_begin, bbox_end);
   }
 
   Sphere(const Ray &_center, const double _radius,
          std::shared_ptr<Material> _mat)
       : center(_center), radius(std::fmax(0, _radius)), mat(_mat) {}
 
+  // for animation, the DynamicBVH holding the sphere must be updated
+  // afterwards
+  void move(const vec3 &center_begin, const vec3 &center_end) {
+    center = Ray(center_begin, center_end - center_begin);
+    auto half_bbox = vec3(radius, radius, radius);
+    bbox_begin = AABB(center.at(0) - half_bbox, center.at(0) + half_bbox);
+    bbox_end = AABB(center.at(1) - half_bbox, center.at(1) + half_bbox);
+    bbox = AABB(bbox_begin, bbox_end);
+  }
+
   virtual bool hit(const Ray &r, const Interval &ray_t,
                    HitRecord &rec) const override {
+    RENDER_STAT(sphere_tests);
     vec3 oc = center.at(r.time()) - r.origin();
     auto a = glm::dot(r.direction(), r.direction());
     auto h = glm::dot(r.direction(), oc);
@@ -69,21 +82,109 @@ public:
       }
     }
 
-    // set record
-    auto outnormal = glm::normalize(r.at(root) - center.at(r.time()));
-    rec.set(r.at(root), root, mat);
+    rec.t = root;
+    rec.object = this;
+    return true;
+  }
+
+  void finalize(const Ray &r, HitRecord &rec) const override {
+    auto outnormal = glm::normalize(r.at(rec.t) - center.at(r.time()));
+    rec.set(r.at(rec.t), rec.t, mat);
     rec.set_face_normal(r, outnormal);
+    rec.object_id = id;
     get_sphere_uv(outnormal, rec.u, rec.v);
+  }
 
-    return true;
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    RENDER_STAT_ADD(sphere_tests, packet.active_count());
+    const auto &c0 = center.origin();
+    const auto &dc = center.direction();
+    double roots[RayPacket::size];
+    bool valid[RayPacket::size];
+    bool any = false;
+
+    // the same quadratic as hit(), for all lanes at once
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      auto ocx = c0.x + packet.time[lane] * dc.x - packet.ox[lane];
+      auto ocy = c0.y + packet.time[lane] * dc.y - packet.oy[lane];
+      auto ocz = c0.z + packet.time[lane] * dc.z - packet.oz[lane];
+      auto dx = packet.dx[lane], dy = packet.dy[lane], dz = packet.dz[lane];
+      auto a = dx * dx + dy * dy + dz * dz;
+      auto h = dx * ocx + dy * ocy + dz * ocz;
+      auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+
+      auto discriminant = h * h - a * c;
+      auto sqrtd = std::sqrt(std::fmax(discriminant, 0.));
+      auto near_root = (h - sqrtd) / a;
+      auto far_root = (h + sqrtd) / a;
+      bool near_ok = t_min < near_root && near_root < hits.t_max[lane];
+      bool far_ok = t_min < far_root && far_root < hits.t_max[lane];
+
+      roots[lane] = near_ok ? near_root : far_root;
+      valid[lane] =
+          packet.active[lane] && discriminant >= 0 && (near_ok || far_ok);
+      any |= valid[lane];
+    }
+    if (!any)
+      return;
+
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      if (!valid[lane])
+        continue;
+      hits.rec[lane].t = roots[lane];
+      hits.rec[lane].object = this;
+      hits.t_max[lane] = roots[lane];
+      hits.is_hit[lane] = true;
+    }
   }
 
   virtual AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
+
+  // light sampling: directions are uniform in the cone the sphere subtends,
+  // or over all directions from inside it. a moving sphere is sampled where
+  // it is at time 0
+  double pdf_value(const vec3 &origin, const vec3 &direction) const override {
+    auto cos_theta_max = get_cos_theta_max(origin);
+    if (cos_theta_max < 0)
+      return 1 / (4 * PI);
+    HitRecord rec;
+    if (!hit(Ray(origin, direction), Interval(0.001, infinity), rec))
+      return 0;
+    return 1 / (2 * PI * (1 - cos_theta_max));
+  }
+
+  vec3 random(const vec3 &origin) const override {
+    return random(origin, vec2(random_double(), random_double()));
+  }
+
+  vec3 random(const vec3 &origin, const vec2 &sample) const override {
+    auto cos_theta_max = get_cos_theta_max(origin);
+    if (cos_theta_max < 0)
+      return random_unit_vec3(sample);
+    auto z = 1 + sample.y * (cos_theta_max - 1);
+    auto r = std::sqrt(std::fmax(0., 1 - z * z));
+    double sin_phi, cos_phi;
+    fast_sincos(2 * PI * sample.x, sin_phi, cos_phi);
+    ONB uvw(center.at(0) - origin);
+    return uvw.transform(vec3(r * cos_phi, r * sin_phi, z));
+  }
 
 private:
   // the sphere can be moving
   Ray center;
   double radius;
   std::shared_ptr<Material> mat;
-  AABB bbox;
+  AABB bbox, bbox_begin, bbox_end;
+
+  // of the cone towards the sphere, -1 if the origin is inside it
+  double get_cos_theta_max(const vec3 &origin) const {
+    auto offset = center.at(0) - origin;
+    auto distance_squared = glm::dot(offset, offset);
+    if (distance_squared <= radius * radius)
+      return -1;
+    return std::sqrt(1 - radius * radius / distance_squared);
+  }
 };
\ No newline at end of file
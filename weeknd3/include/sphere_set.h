@@ -0,0 +1,240 @@
+#pragma once
+#include "hittable.h"
+#include "sphere.h"
+#include <algorithm>
+
+// a sphere as it is handed to make_sphere_sets()
+struct SphereDesc {
+  vec3 center_begin;
+  vec3 center_end;
+  double radius;
+  shared_ptr<Material> mat;
+};
+
+// up to size nearby spheres stored as structure of arrays
+// all of them are tested in one loop over the lanes, which the compiler turns
+// into simd code
+class SphereSet : public Hittable {
+public:
+  static const int size = 8;
+
+  SphereSet() {
+    for (int lane = 0; lane < size; ++lane) {
+      cx[lane] = cy[lane] = cz[lane] = 0;
+      mx[lane] = my[lane] = mz[lane] = 0;
+      radius_squared[lane] = 0;
+      ids[lane] = 0;
+    }
+  }
+
+  int get_count() const { return count; }
+
+  // false when the set is full
+  bool add(const SphereDesc &sphere) {
+    if (count == size)
+      return false;
+    auto r = std::fmax(0, sphere.radius);
+    auto motion = sphere.center_end - sphere.center_begin;
+    cx[count] = sphere.center_begin.x;
+    cy[count] = sphere.center_begin.y;
+    cz[count] = sphere.center_begin.z;
+    mx[count] = motion.x;
+    my[count] = motion.y;
+    mz[count] = motion.z;
+    radius_squared[count] = r * r;
+    mats[count] = sphere.mat;
+    // every sphere keeps its own id for the aov output
+    ids[count] = next_object_id();
+    ++count;
+
+    auto half_bbox = vec3(r, r, r);
+    AABB box_begin(sphere.center_begin - half_bbox,
+                   sphere.center_begin + half_bbox);
+    AABB box_end(sphere.center_end - half_bbox, sphere.center_end + half_bbox);
+    bbox_begin = AABB(bbox_begin, box_begin);
+    bbox_end = AABB(bbox_end, box_end);
+    bbox = AABB(bbox_begin, bbox_end);
+    return true;
+  }
+
+  void debugp() const override {
+    std::clog << "spheres(" << count << ")" << std::flush;
+  }
+
+  AABB get_bbox() const override { return bbox; }
+  AABB get_bbox_begin() const override { return bbox_begin; }
+  AABB get_bbox_end() const override { return bbox_end; }
+
+  // every lane is computed however many are used, and one simd test stands
+  // for several scalar ones
+  double intersection_cost() const override { return 1 + size / 4.; }
+
+  bool hit(const Ray &r, const Interval &ray_t, HitRecord &rec) const override {
+    RENDER_STAT(sphere_set_tests);
+    const auto &o = r.origin();
+    const auto &d = r.direction();
+    const auto time = r.time();
+    const auto a = glm::dot(d, d);
+    const auto t_min = ray_t.min, t_max = ray_t.max;
+
+    // same quadratic as Sphere::hit, lanes past count never hit
+    // bitwise & and | keep the loop free of branches, so it is vectorized
+    double roots[size];
+    for (int lane = 0; lane < size; ++lane) {
+      auto ocx = cx[lane] + time * mx[lane] - o.x;
+      auto ocy = cy[lane] + time * my[lane] - o.y;
+      auto ocz = cz[lane] + time * mz[lane] - o.z;
+      auto h = d.x * ocx + d.y * ocy + d.z * ocz;
+      auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius_squared[lane];
+      auto discriminant = h * h - a * c;
+      auto sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0.);
+      auto near_root = (h - sqrtd) / a;
+      auto far_root = (h + sqrtd) / a;
+      bool near_ok = (t_min < near_root) & (near_root < t_max);
+      bool far_ok = (t_min < far_root) & (far_root < t_max);
+      bool valid = (lane < count) & (discriminant >= 0) & (near_ok | far_ok);
+      auto root = near_ok ? near_root : far_root;
+      roots[lane] = valid ? root : infinity;
+    }
+
+    int closest = 0;
+    for (int lane = 1; lane < size; ++lane)
+      if (roots[lane] < roots[closest])
+        closest = lane;
+    if (roots[closest] == infinity)
+      return false;
+
+    rec.t = roots[closest];
+    rec.object = this;
+    rec.primitive = uint32_t(closest);
+    return true;
+  }
+
+  // the spheres in the outer loop and the rays of the packet in the
+  // vectorized inner one, a later sphere only replaces a hit when it is
+  // strictly closer, so lanes end on the same sphere as with hit()
+  void hit_packet(const RayPacket &packet, double t_min,
+                  PacketHit &hits) const override {
+    RENDER_STAT_ADD(sphere_set_tests, packet.active_count());
+    // inactive lanes get an empty interval and the sphere index is kept as
+    // a double, the inner loop only works on doubles and stays vectorized
+    double closest[RayPacket::size];
+    double closest_sphere[RayPacket::size];
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      closest[lane] = packet.active[lane] ? hits.t_max[lane] : -infinity;
+      closest_sphere[lane] = -1;
+    }
+
+    for (int sphere = 0; sphere < count; ++sphere) {
+      for (int lane = 0; lane < RayPacket::size; ++lane) {
+        auto t = packet.time[lane];
+        auto ocx = cx[sphere] + t * mx[sphere] - packet.ox[lane];
+        auto ocy = cy[sphere] + t * my[sphere] - packet.oy[lane];
+        auto ocz = cz[sphere] + t * mz[sphere] - packet.oz[lane];
+        auto dx = packet.dx[lane], dy = packet.dy[lane], dz = packet.dz[lane];
+        auto a = dx * dx + dy * dy + dz * dz;
+        auto h = dx * ocx + dy * ocy + dz * ocz;
+        auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius_squared[sphere];
+        auto discriminant = h * h - a * c;
+        auto sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0.);
+        auto near_root = (h - sqrtd) / a;
+        auto far_root = (h + sqrtd) / a;
+        bool near_ok = (t_min < near_root) & (near_root < closest[lane]);
+        bool far_ok = (t_min < far_root) & (far_root < closest[lane]);
+        bool valid = (discriminant >= 0) & (near_ok | far_ok);
+        auto root = near_ok ? near_root : far_root;
+        closest[lane] = valid ? root : closest[lane];
+        closest_sphere[lane] = valid ? double(sphere) : closest_sphere[lane];
+      }
+    }
+
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      if (closest_sphere[lane] < 0)
+        continue;
+      hits.rec[lane].t = closest[lane];
+      hits.rec[lane].object = this;
+      hits.rec[lane].primitive = uint32_t(closest_sphere[lane]);
+      hits.t_max[lane] = closest[lane];
+      hits.is_hit[lane] = true;
+    }
+  }
+
+  void finalize(const Ray &r, HitRecord &rec) const override {
+    const auto lane = rec.primitive;
+    auto center = vec3(cx[lane], cy[lane], cz[lane]) +
+                  r.time() * vec3(mx[lane], my[lane], mz[lane]);
+    auto outnormal = glm::normalize(r.at(rec.t) - center);
+    rec.set(r.at(rec.t), rec.t, mats[lane]);
+    rec.set_face_normal(r, outnormal);
+    rec.object_id = ids[lane];
+    get_sphere_uv(outnormal, rec.u, rec.v);
+  }
+
+private:
+  // centers at time 0 and their motion over the shutter interval
+  alignas(64) double cx[size], cy[size], cz[size];
+  alignas(64) double mx[size], my[size], mz[size];
+  alignas(64) double radius_squared[size];
+  shared_ptr<Material> mats[size];
+  int ids[size];
+  int count = 0;
+  AABB bbox, bbox_begin, bbox_end;
+};
+
+// groups the spheres into sets of nearby spheres by recursive median splits,
+// so that the bvh above them stays tight
+inline void make_sphere_sets(std::vector<SphereDesc> &spheres, size_t start,
+                             size_t end, HittableList &sets) {
+  if (end == start)
+    return;
+  if (end - start <= size_t(SphereSet::size)) {
+    auto set = make_shared<SphereSet>();
+    for (auto index = start; index < end; ++index)
+      set->add(spheres[index]);
+    sets.add(set);
+    return;
+  }
+
+  auto center = [](const SphereDesc &sphere) {
+    return (sphere.center_begin + sphere.center_end) * 0.5;
+  };
+  auto bounds = AABB::get_empty();
+  for (auto index = start; index < end; ++index) {
+    auto c = center(spheres[index]);
+    bounds = AABB(bounds, AABB(c, c));
+  }
+  int axis = bounds.longest_axis();
+  // split at a multiple of the set size, so that only one set is not full
+  auto groups = (end - start + SphereSet::size - 1) / SphereSet::size;
+  auto mid = start + groups / 2 * SphereSet::size;
+  std::nth_element(spheres.begin() + start, spheres.begin() + mid,
+                   spheres.begin() + end,
+                   [&](const SphereDesc &a, const SphereDesc &b) {
+                     return center(a)[axis] < center(b)[axis];
+                   });
+  make_sphere_sets(spheres, start, mid, sets);
+  make_sphere_sets(spheres, mid, end, sets);
+}
+
+// spheres much bigger than the typical one (e.g. a ground sphere) would make
+// the box of their set cover the whole scene, they stay single spheres
+inline void make_sphere_sets(std::vector<SphereDesc> &spheres,
+                             HittableList &sets) {
+  if (spheres.empty())
+    return;
+  std::vector<double> radii;
+  for (const auto &sphere : spheres)
+    radii.push_back(sphere.radius);
+  std::nth_element(radii.begin(), radii.begin() + radii.size() / 2,
+                   radii.end());
+  const auto max_radius = 4 * radii[radii.size() / 2];
+
+  auto big = std::partition(spheres.begin(), spheres.end(),
+                            [&](const SphereDesc &sphere) {
+                              return sphere.radius <= max_radius;
+                            });
+  for (auto sphere = big; sphere != spheres.end(); ++sphere)
+    sets.add(make_shared<Sphere>(sphere->center_begin, sphere->center_end,
+                                 sphere->radius, sphere->mat));
+  make_sphere_sets(spheres, 0, big - spheres.begin(), sets);
+}
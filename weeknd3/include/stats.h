@@ -0,0 +1,140 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// ray tracing counters, compiled in with -DRENDER_STATS=ON
+// every thread counts into its own RenderStats, the camera sums them per row,
+// so counting is a plain increment of thread local memory
+// without RENDER_STATS the RENDER_STAT macros expand to nothing
+
+#ifdef RENDER_STATS
+#define RENDER_STAT(counter) (++thread_stats().counter)
+#define RENDER_STAT_ADD(counter, amount) (thread_stats().counter += (amount))
+#define RENDER_STAT_PATH(length) (thread_stats().add_path(length))
+#else
+#define RENDER_STAT(counter) ((void)0)
+#define RENDER_STAT_ADD(counter, amount) ((void)0)
+#define RENDER_STAT_PATH(length) ((void)0)
+#endif
+
+struct RenderStats {
+#ifdef RENDER_STATS
+  static const bool enabled = true;
+#else
+  static const bool enabled = false;
+#endif
+  // paths longer than this are counted in the last bin
+  static const int max_path_length = 63;
+
+  // rays intersected with the scene
+  long long camera_rays = 0;
+  long long bounce_rays = 0;
+  // rays with a closest hit
+  long long hits = 0;
+  // bvh nodes entered, including those of meshes and instances
+  long long bvh_nodes = 0;
+  // box slab tests, a packet test counts its active lanes
+  long long aabb_tests = 0;
+  // primitive tests by type, packet tests count their active lanes
+  long long sphere_tests = 0;
+  long long sphere_set_tests = 0;
+  long long quad_tests = 0;
+  long long box_tests = 0;
+  long long triangle_tests = 0;
+  long long medium_tests = 0;
+  // rays moved into object space by Transform and Instance
+  long long transform_tests = 0;
+  // number of rays of a path when it ends
+  long long path_lengths[max_path_length + 1] = {};
+  // paths ended by the depth limit (there is no russian roulette)
+  long long depth_limit_terminations = 0;
+  // heap allocations while tracing, the pdfs of scattering, counted by
+  // make_pdf()
+  long long allocations = 0;
+
+  void add(const RenderStats &other) {
+    camera_rays += other.camera_rays;
+    bounce_rays += other.bounce_rays;
+    hits += other.hits;
+    bvh_nodes += other.bvh_nodes;
+    aabb_tests += other.aabb_tests;
+    sphere_tests += other.sphere_tests;
+    sphere_set_tests += other.sphere_set_tests;
+    quad_tests += other.quad_tests;
+    box_tests += other.box_tests;
+    triangle_tests += other.triangle_tests;
+    medium_tests += other.medium_tests;
+    transform_tests += other.transform_tests;
+    for (int length = 0; length <= max_path_length; ++length)
+      path_lengths[length] += other.path_lengths[length];
+    depth_limit_terminations += other.depth_limit_terminations;
+    allocations += other.allocations;
+  }
+
+  void add_path(int length) {
+    ++path_lengths[std::min(std::max(length, 0), max_path_length)];
+  }
+
+  void report(std::ostream &output) const {
+    auto rays = camera_rays + bounce_rays;
+    auto per_ray = [&](long long count) {
+      return rays > 0 ? double(count) / rays : 0.;
+    };
+    output << "rays: " << camera_rays << " camera, " << bounce_rays
+           << " bounce, " << hits << " hits\n"
+           << "per ray: " << per_ray(bvh_nodes) << " bvh nodes, "
+           << per_ray(aabb_tests) << " box tests, "
+           << per_ray(primitive_tests()) << " primitive tests\n"
+           << "primitive tests: " << sphere_tests << " spheres, "
+           << sphere_set_tests << " sphere sets, " << quad_tests << " quads, "
+           << box_tests << " boxes, " << triangle_tests << " triangles, "
+           << medium_tests << " media, " << transform_tests
+           << " transforms\n"
+           << "paths: " << depth_limit_terminations
+           << " ended by the depth limit, " << allocations
+           << " allocations\npath lengths:";
+    for (int length = 0; length <= max_path_length; ++length)
+      if (path_lengths[length] > 0)
+        output << " " << length << ":" << path_lengths[length];
+    output << std::endl;
+  }
+
+  bool write_json(const std::string &filename) const {
+    std::ofstream output(filename);
+    output << "{\n  \"camera_rays\": " << camera_rays
+           << ",\n  \"bounce_rays\": " << bounce_rays
+           << ",\n  \"hits\": " << hits << ",\n  \"bvh_nodes\": " << bvh_nodes
+           << ",\n  \"aabb_tests\": " << aabb_tests
+           << ",\n  \"primitive_tests\": {\"sphere\": " << sphere_tests
+           << ", \"sphere_set\": " << sphere_set_tests
+           << ", \"quad\": " << quad_tests << ", \"box\": " << box_tests
+           << ", \"triangle\": " << triangle_tests
+           << ", \"medium\": " << medium_tests
+           << ", \"transform\": " << transform_tests
+           << "},\n  \"depth_limit_terminations\": "
+           << depth_limit_terminations
+           << ",\n  \"allocations\": " << allocations
+           << ",\n  \"path_lengths\": [";
+    for (int length = 0; length <= max_path_length; ++length)
+      output << (length ? ", " : "") << path_lengths[length];
+    output << "]\n}" << std::endl;
+    return bool(output);
+  }
+
+  long long primitive_tests() const {
+    return sphere_tests + sphere_set_tests + quad_tests + box_tests +
+           triangle_tests + medium_tests;
+  }
+
+  // traversal work, the cost of the heatmap
+  long long steps() const { return bvh_nodes + primitive_tests(); }
+};
+
+// the counters of the calling thread, constant initialized, so reaching them
+// costs no more than a thread_local integer
+inline RenderStats &thread_stats() {
+  static thread_local RenderStats stats;
+  return stats;
+}
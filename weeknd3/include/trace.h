@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// timeline of the render phases (scene loading, bvh builds, rows per thread,
+// denoising, output) in the chrome trace event format, which
+// https://ui.perfetto.dev and chrome://tracing open
+// spans are only recorded after Tracer::get().start(), before that a span
+// costs one relaxed load
+
+// small ids in the order threads first record a span, 0 is usually main
+inline int trace_thread_id() {
+  static std::atomic<int> next_id(0);
+  static thread_local int id = next_id++;
+  return id;
+}
+
+class Tracer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  static Tracer &get() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+  // times are relative to this call
+  void start() {
+    origin = clock::now();
+    enabled.store(true, std::memory_order_relaxed);
+  }
+
+  // name and arg_name must be string literals, arg_name may be null
+  void add(const char *name, const char *arg_name, long long arg,
+           clock::time_point begin, clock::time_point end) {
+    Event event{name, arg_name, arg, microseconds(begin),
+                microseconds(end) - microseconds(begin), trace_thread_id()};
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(event);
+  }
+
+  // one complete ("X") event per span and the names of the threads
+  bool write(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream output(filename);
+    // microseconds, fixed so that long runs are not printed in e notation
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    int thread_count = 0;
+    for (size_t k = 0; k < events.size(); ++k) {
+      const auto &event = events[k];
+      output << (k ? ",\n" : "\n") << "{\"name\": \"" << event.name
+             << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+             << ", \"ts\": " << event.begin << ", \"dur\": " << event.duration;
+      if (event.arg_name)
+        output << ", \"args\": {\"" << event.arg_name << "\": " << event.arg
+               << "}";
+      output << "}";
+      thread_count = std::max(thread_count, event.thread + 1);
+    }
+    for (int thread = 0; thread < thread_count; ++thread)
+      output << (events.empty() ? "\n" : ",\n")
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": "
+             << thread << ", \"args\": {\"name\": \""
+             << (thread == 0 ? "main" : "thread " + std::to_string(thread))
+             << "\"}}";
+    output << "\n]}" << std::endl;
+    return bool(output);
+  }
+
+private:
+  struct Event {
+    const char *name;
+    const char *arg_name;
+    long long arg;
+    double begin;
+    double duration;
+    int thread;
+  };
+
+  std::atomic<bool> enabled{false};
+  clock::time_point origin;
+  std::mutex mutex;
+  std::vector<Event> events;
+
+  double microseconds(clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time - origin).count();
+  }
+};
+
+// records the time from its construction to the end of the scope
+class TraceSpan {
+public:
+  TraceSpan(const char *_name, const char *_arg_name = nullptr,
+            long long _arg = 0)
+      : name(_name), arg_name(_arg_name), arg(_arg),
+        is_enabled(Tracer::get().is_enabled()) {
+    if (is_enabled)
+      begin = Tracer::clock::now();
+  }
+
+  ~TraceSpan() {
+    if (is_enabled)
+      Tracer::get().add(name, arg_name, arg, begin, Tracer::clock::now());
+  }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *name;
+  const char *arg_name;
+  long long arg;
+  bool is_enabled;
+  Tracer::clock::time_point begin;
+};
@@ -0,0 +1,298 @@
+#pragma once
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "pdf.h"
+#include "perf_counter.h"
+#include "ray_sort.h"
+#include "sampler.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+// Recursive: one path at a time, depth first through ray_color
+// Wavefront: a batch of paths advances one bounce at a time, stage by stage
+enum class IntegratorType { Recursive, Wavefront };
+
+// state of the paths in flight, structure of arrays
+class PathQueue {
+public:
+  std::vector<vec3> origin;
+  std::vector<vec3> direction;
+  std::vector<double> time;
+  std::vector<color> throughput;
+  // index of the pixel in the framebuffer (j * width + i)
+  std::vector<int> pixel;
+  std::vector<int> sample;
+  // remaining bounces, the same meaning as in Camera::ray_color
+  std::vector<int> depth;
+
+  size_t size() const { return pixel.size(); }
+
+  void clear() {
+    origin.clear();
+    direction.clear();
+    time.clear();
+    throughput.clear();
+    pixel.clear();
+    sample.clear();
+    depth.clear();
+  }
+
+  void reserve(size_t n) {
+    origin.reserve(n);
+    direction.reserve(n);
+    time.reserve(n);
+    throughput.reserve(n);
+    pixel.reserve(n);
+    sample.reserve(n);
+    depth.reserve(n);
+  }
+
+  void push(const Ray &r, const color &_throughput, int _pixel, int _sample,
+            int _depth) {
+    origin.push_back(r.origin());
+    direction.push_back(r.direction());
+    time.push_back(r.time());
+    throughput.push_back(_throughput);
+    pixel.push_back(_pixel);
+    sample.push_back(_sample);
+    depth.push_back(_depth);
+  }
+
+  void swap(PathQueue &other) {
+    origin.swap(other.origin);
+    direction.swap(other.direction);
+    time.swap(other.time);
+    throughput.swap(other.throughput);
+    pixel.swap(other.pixel);
+    sample.swap(other.sample);
+    depth.swap(other.depth);
+  }
+
+  void reorder(const std::vector<int> &order) {
+    apply_order(origin, order);
+    apply_order(direction, order);
+    apply_order(time, order);
+    apply_order(throughput, order);
+    apply_order(pixel, order);
+    apply_order(sample, order);
+    apply_order(depth, order);
+  }
+
+  Ray ray(size_t k) const { return Ray(origin[k], direction[k], time[k]); }
+};
+
+// cost of the intersect stage, to judge whether ray sorting pays off
+struct WavefrontStats {
+  long long rays = 0;
+  double intersect_seconds = 0;
+  double sort_seconds = 0;
+  // -1 if hardware counters are not available
+  int64_t cache_misses = -1;
+
+  void report(std::ostream &output) const {
+    output << "intersect: " << rays << " rays in " << intersect_seconds
+           << " s, " << rays / intersect_seconds * 1e-6 << " Mrays/s";
+    if (cache_misses >= 0)
+      output << ", " << cache_misses << " cache misses ("
+             << double(cache_misses) / rays << " per ray)";
+    else
+      output << ", cache misses unavailable";
+    output << "\nray sorting: " << sort_seconds << " s" << std::endl;
+  }
+};
+
+// wavefront path tracer
+// the caller generates camera rays into the queue, then trace() runs
+//   intersect -> sort by material -> shade/scatter -> accumulate
+// over the whole batch for every bounce, so each stage is a tight loop over
+// many paths instead of one deep recursion per path
+// the estimator is the same as Camera::ray_color: light sampling is done by
+// the mixture pdf, so there is no separate shadow ray stage
+class WavefrontIntegrator {
+public:
+  WavefrontIntegrator(const Hittable &_lights, const color &_background,
+                      const int _max_depth, const int _camera_dimensions,
+                      const int _bounce_dimensions)
+      : lights(_lights), background(_background), max_depth(_max_depth),
+        camera_dimensions(_camera_dimensions),
+        bounce_dimensions(_bounce_dimensions),
+        light_mix_rate(get_light_mix_rate(_lights)) {}
+
+  // stage 1: camera rays
+  void push_camera_ray(const Ray &r, int pixel, int sample) {
+    if (max_depth > 0)
+      queue.push(r, color(1, 1, 1), pixel, sample, max_depth);
+  }
+
+  size_t size() const { return queue.size(); }
+
+  // reorder the rays by octant and morton codes before every intersect stage
+  void set_ray_sorting(bool _sort_rays) { sort_rays = _sort_rays; }
+
+  const WavefrontStats &get_stats() const { return stats; }
+
+  // trace every queued path until it terminates, radiance and first-hit aovs
+  // are summed into fb (the caller divides by the sample count)
+  void trace(const Hittable &objects, FrameBuffer &fb, Sampler &sampler) {
+    while (queue.size() > 0) {
+      if (sort_rays)
+        sort_by_ray(objects.get_bbox());
+      intersect(objects, fb.get_width(), sampler);
+      sort_by_material();
+      shade(fb, sampler);
+      queue.swap(next);
+      next.clear();
+    }
+  }
+
+private:
+  const Hittable &lights;
+  color background;
+  int max_depth;
+  int camera_dimensions;
+  int bounce_dimensions;
+  double light_mix_rate;
+
+  bool sort_rays = false;
+  WavefrontStats stats;
+  CacheMissCounter cache_misses;
+
+  PathQueue queue;
+  PathQueue next;
+  std::vector<HitRecord> hits;
+  std::vector<char> is_hit;
+  std::vector<uint64_t> keys;
+  // paths in the order they are shaded
+  std::vector<int> order;
+
+  // optional stage before 2: bin rays for coherent traversal
+  void sort_by_ray(const AABB &bounds) {
+    auto begin = std::chrono::steady_clock::now();
+    const auto n = queue.size();
+    keys.resize(n);
+    for (size_t k = 0; k < n; ++k)
+      keys[k] = ray_sort_key(queue.origin[k], queue.direction[k], bounds);
+    sort_by_key(keys, order);
+    queue.reorder(order);
+    stats.sort_seconds += std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - begin)
+                              .count();
+  }
+
+  // stage 2: closest hit of every path
+  // media draw from the random stream while they are intersected, it is keyed
+  // per path so that they do not depend on the order of the queue, and like
+  // Camera::key_intersection so that the recursive integrator agrees
+  void intersect(const Hittable &objects, int width, Sampler &sampler) {
+    const auto n = queue.size();
+    hits.resize(n);
+    is_hit.resize(n);
+    auto begin = std::chrono::steady_clock::now();
+    cache_misses.start();
+    for (size_t k = 0; k < n; ++k) {
+      auto r = queue.ray(k);
+      sampler.start_pixel(queue.pixel[k] % width, queue.pixel[k] / width);
+      sampler.start_sample(queue.sample[k]);
+      sampler.set_dimension(camera_dimensions +
+                            bounce_dimensions * (max_depth - queue.depth[k]));
+      sampler.key_random(1);
+      is_hit[k] = objects.hit(r, Interval::get_positive(), hits[k]);
+      if (is_hit[k])
+        hits[k].finalize(r);
+      if (queue.depth[k] == max_depth)
+        RENDER_STAT(camera_rays);
+      else
+        RENDER_STAT(bounce_rays);
+      RENDER_STAT_ADD(hits, is_hit[k]);
+    }
+    cache_misses.stop();
+    stats.intersect_seconds += std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - begin)
+                                   .count();
+    stats.rays += n;
+    stats.cache_misses = cache_misses.read();
+  }
+
+  // stage 3: group hit points by material so that shading runs the same
+  // scatter() back to back, misses go first
+  void sort_by_material() {
+    order.resize(queue.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      auto id_a = is_hit[a] ? hits[a].mat->get_id() : 0;
+      auto id_b = is_hit[b] ? hits[b].mat->get_id() : 0;
+      return id_a < id_b;
+    });
+  }
+
+  // stage 4 and 5: shade, scatter into the next queue, accumulate
+  void shade(FrameBuffer &fb, Sampler &sampler) {
+    const int width = fb.get_width();
+    for (auto k : order) {
+      const int i = queue.pixel[k] % width;
+      const int j = queue.pixel[k] / width;
+      const bool is_camera_ray = queue.depth[k] == max_depth;
+      const auto &throughput = queue.throughput[k];
+
+      if (!is_hit[k]) {
+        RENDER_STAT_PATH(max_depth - queue.depth[k] + 1);
+        fb.beauty.at(i, j) += throughput * background;
+        if (is_camera_ray)
+          fb.albedo.at(i, j) += color(1, 1, 1);
+        continue;
+      }
+
+      const auto &rec = hits[k];
+      Ray r = queue.ray(k);
+      sampler.start_pixel(i, j);
+      sampler.start_sample(queue.sample[k]);
+      sampler.set_dimension(camera_dimensions +
+                            bounce_dimensions * (max_depth - queue.depth[k]));
+
+      ISRecord srec;
+      color emitted_color = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+      bool is_scattered = rec.mat->scatter(r, rec, srec);
+      fb.beauty.at(i, j) += throughput * emitted_color;
+
+      if (is_camera_ray) {
+        fb.albedo.at(i, j) += is_scattered ? srec.attenuation : color(1, 1, 1);
+        fb.normal.at(i, j) += rec.normal;
+        fb.depth.at(i, j) += rec.t * glm::length(r.direction());
+        if (queue.sample[k] == 0) {
+          fb.material_id.at(i, j) = rec.mat->get_id();
+          fb.object_id.at(i, j) = rec.object_id;
+        }
+      }
+
+      // a ray with no bounce left would return black anyway
+      const int depth = queue.depth[k] - 1;
+      if (!is_scattered) {
+        RENDER_STAT_PATH(max_depth - depth);
+        continue;
+      }
+      if (depth <= 0) {
+        RENDER_STAT(depth_limit_terminations);
+        RENDER_STAT_PATH(max_depth);
+        continue;
+      }
+
+      if (srec.is_direction_determined) {
+        next.push(srec.skip_pdf_ray, throughput * srec.attenuation,
+                  queue.pixel[k], queue.sample[k], depth);
+        continue;
+      }
+
+      auto p0 = make_pdf<HittablePDF>(lights, rec.p);
+      MixturePDF mixed_pdf(p0, srec.pdf_ptr, light_mix_rate);
+
+      Ray scattered = Ray(rec.p, mixed_pdf.generate(sampler), r.time());
+      double pdf_value = mixed_pdf.value(scattered.direction());
+      double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+      next.push(scattered,
+                throughput * srec.attenuation * scatter_pdf / pdf_value,
+                queue.pixel[k], queue.sample[k], depth);
+    }
+  }
+};
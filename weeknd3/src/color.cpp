@@ -6,7 +6,7 @@
 double linear2gamma(double component){
   static const double factor = 1. / 2.2;
   // use power instead of sqrt here
-  return component > 0 ? std::pow(component, factor) : 0;
+  return component > 0 ? fast_pow(component, factor) : 0;
 }
 
 void write_color(std::ostream &output, const color &pixel_color) {
@@ -23,6 +23,6 @@ void write_color(std::ostream &output, const color &pixel_color) {
   // int gbyte = (int)(255.999 * pixel_color.g);
   // int bbyte = (int)(255.999 * pixel_color.b);
 
-  std::cout << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+  output << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
   return;
 }
\ No newline at end of file